@@ -0,0 +1,490 @@
+#include <properties_file_reader.h>
+#include <csv_file_reader.h>
+#include <csv_column_reader.h>
+#include <csv_indexed_reader.h>
+#include <csv_multi_reader.h>
+#include <reloadable_properties.h>
+
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <map>
+#include <mutex>
+
+using namespace utils;
+
+/**
+  *  \brief Runs func a few times and prints the best throughput
+  *  @param name [in] Name of the benchmark
+  *  @param bytes [in] Number of bytes processed by each run
+  *  @param func [in] Function to be measured. Returns a value which is accumulated, so the work cannot be optimized away
+  */
+template<class FUNC>
+void measure(const std::string& name, size_t bytes, FUNC&& func) {
+  constexpr int RUNS{ 5 };
+  double best{ 1e100 };
+  size_t check{ 0 };
+  for (int i = 0; i < RUNS; ++i) {
+    auto start{ std::chrono::steady_clock::now() };
+    check += size_t(func());
+    std::chrono::duration<double> elapsed{ std::chrono::steady_clock::now() - start };
+    if (elapsed.count() < best) best = elapsed.count();
+  }
+  std::cout << name << ": " << (double(bytes) / (1 << 20)) / best << " MB/s (" << best * 1000 << " ms, check " << check / RUNS << ")" << std::endl;
+}
+
+/**
+  *  \brief Generates CSV content with the given number of lines
+  */
+std::string makeCSV(size_t lines) {
+  std::string text;
+  for (size_t i = 0; i < lines; ++i)
+    text += std::to_string(i) + ";name_" + std::to_string(i % 1000) + ";" + std::to_string(double(i) * 0.25) + ";" + std::to_string(i * 7 % 100000) + ";some longer text field\n";
+  return text;
+}
+
+
+/// TOKENIZERS ***************************************************************
+void benchmarkTokenizers(const std::string& text) {
+  std::cout << std::endl << "Tokenizers (" << text.size() / (1 << 20) << " MB)" << std::endl;
+
+  measure("Tokenizer", text.size(), [&text]() {
+    Tokenizer tokenizer;
+    std::vector<std::string> tokens;
+    size_t count{ 0 }, pos{ 0 }, eol;
+    while ((eol = text.find('\n', pos)) != std::string::npos) {
+      tokenizer(tokens, std::string(text, pos, eol - pos), ';');
+      count += tokens.size();
+      pos = eol + 1;
+    }
+    return count;
+  });
+
+  const std::pair<SIMDLevel, const char*> levels[]{ { SIMDLevel::SCALAR, "SIMDTokenizer scalar" }, { SIMDLevel::SSE2, "SIMDTokenizer SSE2" }, { SIMDLevel::AVX2, "SIMDTokenizer AVX2" } };
+  for (auto& [level, name] : levels) {
+    if (level > SIMDTokenizer::supported()) continue;
+    measure(name, text.size(), [&text, level = level]() {
+      SIMDTokenizer tokenizer(level);
+      size_t count{ 0 };
+      tokenizer(text, ';', [&count](const Tokens& tokens) { count += tokens.size(); });
+      return count;
+    });
+  }
+}
+
+
+/// NUMERIC CONVERSIONS *****************************************************
+void benchmarkConversions() {
+  std::string text;
+  for (size_t i = 0; i < 1000000; ++i)
+    text += std::to_string(i * 7919 % 1000003) + ";" + std::to_string(double(i) / 7) + ";" + std::to_string(i * 31 % 1000) + ";" + std::to_string(double(i % 5000) * 1.25) + "\n";
+
+  std::cout << std::endl << "Numeric conversions (" << text.size() / (1 << 20) << " MB, 4 numbers per line)" << std::endl;
+
+  std::vector<std::string> fields;
+  size_t start{ 0 };
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] == ';' || text[i] == '\n') {
+      fields.push_back(text.substr(start, i - start));
+      start = i + 1;
+    }
+  }
+
+  measure("atoi/atof", text.size(), [&fields]() {
+    double sum{ 0 };
+    for (size_t i = 0; i < fields.size(); i += 2)
+      sum += atoi(fields[i].c_str()) + atof(fields[i + 1].c_str());
+    return sum;
+  });
+
+  measure("fromString", text.size(), [&fields]() {
+    double sum{ 0 };
+    int ivalue{ 0 };
+    double dvalue{ 0 };
+    for (size_t i = 0; i < fields.size(); i += 2) {
+      fromString(fields[i], ivalue);
+      fromString(fields[i + 1], dvalue);
+      sum += ivalue + dvalue;
+    }
+    return sum;
+  });
+
+  const std::string fileName{ "benchmark-numeric.csv" };
+  std::ofstream(fileName, std::ios::out | std::ios::binary) << text;
+  measure("CSVFileReader<int, double, long, double>", text.size(), [&fileName]() {
+    CSVFileReader<int, double, long, double> csv(fileName, ';');
+    return csv.size();
+  });
+  std::remove(fileName.c_str());
+}
+
+
+/// COLUMNAR STORAGE ********************************************************
+void benchmarkColumns(const std::string& fileName) {
+  std::cout << std::endl << "Sum of one double column, row-major vs columnar storage" << std::endl;
+
+  CSVFileReader<size_t, std::string, double, int, std::string> rows(fileName, ';');
+  CSVColumnReader<size_t, std::string, double, int, std::string> columns(fileName, ';');
+  size_t bytes{ rows.size() * sizeof(double) };
+
+  measure("CSVFileReader rows", bytes, [&rows]() {
+    double sum{ 0 };
+    for (auto& rec : rows) sum += std::get<2>(rec);
+    return sum;
+  });
+
+  measure("CSVColumnReader column<2>()", bytes, [&columns]() {
+    double sum{ 0 };
+    for (double value : columns.column<2>()) sum += value;
+    return sum;
+  });
+}
+
+
+/// COLUMN SELECTION ********************************************************
+void benchmarkSelection() {
+  const size_t COLS{ 120 };
+  std::string text;
+  for (size_t i = 0; i < 50000; ++i) {
+    for (size_t col = 0; col < COLS; ++col)
+      text += std::to_string(double(i * COLS + col) / 8) + (col + 1 < COLS ? "," : "\n");
+  }
+  const std::string fileName{ "benchmark-wide.csv" };
+  std::ofstream(fileName, std::ios::out | std::ios::binary) << text;
+
+  std::cout << std::endl << "Column selection (" << text.size() / (1 << 20) << " MB, " << COLS << " columns)" << std::endl;
+
+  measure("CSVFileReader<double> all columns", text.size(), [&fileName]() {
+    CSVFileReader<double> csv(fileName);
+    return csv.size();
+  });
+  measure("CSVFileReader<double> 3 columns", text.size(), [&fileName]() {
+    CSVFileReader<double> csv(fileName, ',', { 3, 60, 110 });
+    return csv.size();
+  });
+  measure("CSVFileReader<std::string> all columns", text.size(), [&fileName]() {
+    CSVFileReaderStr csv(fileName);
+    return csv.size();
+  });
+  measure("CSVFileReader<std::string> 3 columns", text.size(), [&fileName]() {
+    CSVFileReaderStr csv(fileName, ',', { 3, 60, 110 });
+    return csv.size();
+  });
+  measure("CSVFileReader<double, double, double> 3 columns", text.size(), [&fileName]() {
+    CSVFileReader<double, double, double> csv(fileName, ',', { 3, 60, 110 });
+    return csv.size();
+  });
+
+  std::remove(fileName.c_str());
+}
+
+
+/// PARALLEL PARSING ********************************************************
+void benchmarkParallel(const std::string& fileName, size_t bytes) {
+  std::cout << std::endl << "Parallel parsing of CSVFileReader<size_t, std::string, double, int, std::string>" << std::endl;
+
+  for (size_t threads : { 1u, 2u, 4u, 8u, 0u }) {
+    measure("threads " + (threads ? std::to_string(threads) : std::string("auto")), bytes, [&fileName, threads]() {
+      CSVFileReader<size_t, std::string, double, int, std::string> csv(fileName, ';', CSVInput::MAPPED, threads);
+      return csv.size();
+    });
+  }
+}
+
+
+/// LINE COUNT PRESCAN ******************************************************
+void benchmarkPrescan(const std::string& text, const std::string& fileName) {
+  std::cout << std::endl << "Line count prescan" << std::endl;
+
+  measure("SIMDTokenizer::countLines", text.size(), [&text]() { return SIMDTokenizer::countLines(text); });
+
+  for (bool prescan : { false, true }) {
+    CSVOptions options(';');
+    options.prescan = prescan;
+    measure(std::string("CSVFileReader<size_t, std::string, double, int, std::string> prescan ") + (prescan ? "on" : "off"), text.size(), [&fileName, &options]() {
+      CSVFileReader<size_t, std::string, double, int, std::string> csv(fileName, options);
+      return csv.size();
+    });
+  }
+}
+
+
+/// BINARY CACHE ************************************************************
+void benchmarkCache(const std::string& fileName, size_t bytes) {
+  std::cout << std::endl << "Parsing vs binary cache of CSVFileReader<size_t, std::string, double, int, std::string>" << std::endl;
+
+  CSVOptions options(';');
+  measure("parse", bytes, [&fileName, &options]() {
+    CSVFileReader<size_t, std::string, double, int, std::string> csv(fileName, options);
+    return csv.size();
+  });
+
+  options.cache = fileName + ".cache";
+  CSVFileReader<size_t, std::string, double, int, std::string> writer(fileName, options);
+  measure("cache", bytes, [&fileName, &options]() {
+    CSVFileReader<size_t, std::string, double, int, std::string> csv(fileName, options);
+    return csv.size();
+  });
+  std::remove(options.cache.c_str());
+}
+
+
+/// ARENA STRINGS ***********************************************************
+void benchmarkArena(const std::string& fileName, size_t bytes) {
+  std::cout << std::endl << "Load and destruction, std::string vs std::pmr::string values" << std::endl;
+
+  measure("CSVFileReader<size_t, std::string, double, int, std::string>", bytes, [&fileName]() {
+    CSVFileReader<size_t, std::string, double, int, std::string> csv(fileName, ';');
+    return csv.size();
+  });
+
+  measure("CSVFileReader<size_t, std::pmr::string, double, int, std::pmr::string>", bytes, [&fileName]() {
+    CSVFileReader<size_t, std::pmr::string, double, int, std::pmr::string> csv(fileName, ';');
+    return csv.size();
+  });
+
+  measure("CSVFileReader<std::string>", bytes, [&fileName]() {
+    CSVFileReader<std::string> csv(fileName, ';');
+    return csv.size();
+  });
+
+  measure("CSVFileReader<std::pmr::string>", bytes, [&fileName]() {
+    CSVFileReader<std::pmr::string> csv(fileName, ';');
+    return csv.size();
+  });
+}
+
+
+/// ROW INDEX ***************************************************************
+void benchmarkIndex(const std::string& fileName, size_t bytes) {
+  std::cout << std::endl << "Access to the last record: full load vs row index of CSVIndexedReader" << std::endl;
+  using Reader = CSVIndexedReader<size_t, std::string, double, int, std::string>;
+
+  measure("CSVFileReader, load", bytes, [&fileName]() {
+    CSVFileReader<size_t, std::string, double, int, std::string> csv(fileName, ';');
+    return std::get<0>(csv[csv.size() - 1]);
+  });
+
+  measure("CSVIndexedReader, build index", bytes, [&fileName]() {
+    Reader csv(fileName, ';');
+    return std::get<0>(csv[csv.size() - 1]);
+  });
+
+  const std::string indexName{ fileName + ".idx" };
+  Reader(fileName, ';').saveIndex(indexName);
+  measure("CSVIndexedReader, saved index", bytes, [&fileName, &indexName]() {
+    Reader csv(fileName, ';', 1, indexName);
+    return std::get<0>(csv[csv.size() - 1]);
+  });
+  std::remove(indexName.c_str());
+}
+
+
+/// MULTIPLE FILES **********************************************************
+void benchmarkMultiFiles(const std::string& text) {
+  std::cout << std::endl << "Loading many files: serial loop vs loadFiles on a work stealing pool" << std::endl;
+
+  // One big file, holding half of the lines, and many small ones
+  std::vector<std::string> fileNames;
+  size_t half{ text.find('\n', text.size() / 2) + 1 };
+  fileNames.push_back("benchmark-multi-big.csv");
+  std::ofstream(fileNames.back(), std::ios::out | std::ios::binary) << text.substr(0, half);
+  const size_t FILES{ 500 };
+  size_t start{ half };
+  for (size_t f = 0; f < FILES; ++f) {
+    size_t end{ f + 1 == FILES ? text.size() : text.find('\n', half + (text.size() - half) / FILES * (f + 1)) + 1 };
+    fileNames.push_back("benchmark-multi-" + std::to_string(f) + ".csv");
+    std::ofstream(fileNames.back(), std::ios::out | std::ios::binary) << text.substr(start, end - start);
+    start = end;
+  }
+
+  measure("serial loop", text.size(), [&fileNames]() {
+    size_t records{ 0 };
+    for (auto& fileName : fileNames)
+      records += CSVFileReader<size_t, std::string, double, int, std::string>(fileName, ';').size();
+    return records;
+  });
+
+  measure("loadFiles", text.size(), [&fileNames]() {
+    size_t records{ 0 };
+    for (auto& reader : loadFiles<size_t, std::string, double, int, std::string>(fileNames, CSVOptions(';', CSVInput::MAPPED, 0)))
+      records += reader.size();
+    return records;
+  });
+
+  for (auto& fileName : fileNames)
+    std::remove(fileName.c_str());
+}
+
+
+/// INPUT BACKENDS **********************************************************
+void benchmarkInputs(const std::string& fileName, size_t bytes) {
+  std::cout << std::endl << "Input backends of CSVFileReader<size_t, std::string, double, int, std::string>" << std::endl;
+
+  for (auto [name, input] : { std::make_pair("STREAM", CSVInput::STREAM), std::make_pair("ASYNC", CSVInput::ASYNC), std::make_pair("MAPPED", CSVInput::MAPPED) }) {
+    measure(name, bytes, [&fileName, input = input]() {
+      CSVFileReader<size_t, std::string, double, int, std::string> csv(fileName, ';', input);
+      return csv.size();
+    });
+  }
+}
+
+/// COMPRESSED INPUT ********************************************************
+#ifdef FILE_READER_WITH_ZLIB
+/**
+  *  \brief Compares loading a gzip file, decompressed on the fly, with loading it already decompressed.
+  *         The throughput is measured on the decompressed size
+  */
+void benchmarkCompressed(const std::string& text, const std::string& fileName) {
+  std::cout << std::endl << "Compressed input of CSVFileReader<size_t, std::string, double, int, std::string>" << std::endl;
+
+  const std::string gzipName{ fileName + ".gz" };
+  gzFile file{ gzopen(gzipName.c_str(), "wb6") };
+  gzwrite(file, text.data(), unsigned(text.size()));
+  gzclose(file);
+
+  measure("Decompressed file, MAPPED", text.size(), [&fileName]() {
+    CSVFileReader<size_t, std::string, double, int, std::string> csv(fileName, ';', CSVInput::MAPPED);
+    return csv.size();
+  });
+  for (auto [name, input] : { std::make_pair("gzip file, STREAM", CSVInput::STREAM), std::make_pair("gzip file, ASYNC", CSVInput::ASYNC), std::make_pair("gzip file, MAPPED", CSVInput::MAPPED) }) {
+    measure(name, text.size(), [&gzipName, input = input]() {
+      CSVFileReader<size_t, std::string, double, int, std::string> csv(gzipName, ';', input);
+      return csv.size();
+    });
+  }
+  std::remove(gzipName.c_str());
+}
+#endif
+
+
+/// PROPERTIES LOOKUP *******************************************************
+void benchmarkProperties() {
+  constexpr size_t KEYS{ 2000 };
+  constexpr size_t LOOKUPS{ 2000000 };
+  std::cout << std::endl << "Properties lookup (" << KEYS << " keys, " << LOOKUPS << " lookups of string_view keys)" << std::endl;
+
+  const std::string fileName{ "benchmark.prop" };
+  {
+    std::ofstream file(fileName, std::ios::out | std::ios::binary);
+    for (size_t i = 0; i < KEYS; ++i)
+      file << "server.module" << i % 50 << ".setting" << i << " = " << i << "." << i % 1000 << "\n";
+  }
+  PropertiesFileReader properties(fileName);
+  // A reloadable copy: through a shared_ptr swapped under a mutex, and through lock-free snapshots
+  std::shared_ptr<const PropertiesFileReader> shared{ std::make_shared<const PropertiesFileReader>(fileName) };
+  std::mutex mutex;
+  ReloadableProperties reloadable(fileName);
+  std::remove(fileName.c_str());
+
+  // The previous storage: a multimap, which needs a string key for each lookup
+  std::multimap<std::string, std::string> multimap;
+  for (auto& key : properties.keys())
+    multimap.emplace(key, properties[key]);
+
+  // Each lookup is given the position of its key, so the keys or their handles are taken the same way
+  std::vector<std::string> keys{ properties.keys() };
+  std::vector<std::string_view> names{ keys.begin(), keys.end() };
+  std::vector<size_t> lookups;
+  for (size_t i = 0; i < LOOKUPS; ++i)
+    lookups.push_back(i * 7919 % keys.size());
+
+  auto run = [&lookups, &names](const std::string& name, auto&& lookup) {
+    double best{ 1e100 };
+    size_t check{ 0 };
+    for (int i = 0; i < 5; ++i) {
+      auto start{ std::chrono::steady_clock::now() };
+      for (size_t pos : lookups)
+        check += size_t(lookup(names[pos], pos));
+      std::chrono::duration<double> elapsed{ std::chrono::steady_clock::now() - start };
+      best = std::min(best, elapsed.count());
+    }
+    std::cout << name << ": " << best * 1e9 / double(lookups.size()) << " ns per lookup (check " << check / 5 << ")" << std::endl;
+  };
+
+  run("std::multimap, string", [&multimap](std::string_view key, size_t) {
+    auto range{ multimap.equal_range(std::string(key)) };
+    return range.first != range.second ? range.first->second.size() : 0;
+  });
+  run("PropertiesFileReader, string", [&properties](std::string_view key, size_t) { return properties[key].size(); });
+  run("std::multimap, double", [&multimap](std::string_view key, size_t) {
+    auto range{ multimap.equal_range(std::string(key)) };
+    double value{ 0 };
+    if (range.first != range.second)
+      fromString(range.first->second, value);
+    return value;
+  });
+  run("PropertiesFileReader, double", [&properties](std::string_view key, size_t) { return properties.value<double>(key); });
+
+  // Keys resolved in advance
+  std::vector<PropertiesFileReader::Handle> handles;
+  for (auto& key : keys)
+    handles.push_back(properties.handle(key));
+  run("PropertiesFileReader, double by handle", [&properties, &handles](std::string_view, size_t pos) { return properties.value<double>(handles[pos]); });
+
+  run("Mutex and shared_ptr, double", [&shared, &mutex](std::string_view key, size_t) {
+    std::shared_ptr<const PropertiesFileReader> current;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      current = shared;
+    }
+    return current->value<double>(key);
+  });
+  run("ReloadableProperties, double", [&reloadable](std::string_view key, size_t) { return reloadable.value<double>(key); });
+
+  // The keys of a module: filtering a copy of all the keys, or a range of the sorted keys
+  constexpr size_t QUERIES{ 2000 };
+  auto query = [](const std::string& name, auto&& keysOf) {
+    double best{ 1e100 };
+    size_t check{ 0 };
+    for (int i = 0; i < 5; ++i) {
+      auto start{ std::chrono::steady_clock::now() };
+      for (size_t q = 0; q < QUERIES; ++q)
+        check += keysOf("server.module" + std::to_string(q % 50) + ".");
+      std::chrono::duration<double> elapsed{ std::chrono::steady_clock::now() - start };
+      best = std::min(best, elapsed.count());
+    }
+    std::cout << name << ": " << best * 1e9 / double(QUERIES) << " ns per query (check " << check / 5 << ")" << std::endl;
+  };
+  query("keys() and filter", [&properties](const std::string& prefix) {
+    size_t count{ 0 };
+    for (auto& key : properties.keys())
+      count += key.compare(0, prefix.size(), prefix) == 0;
+    return count;
+  });
+  query("withPrefix", [&properties](const std::string& prefix) {
+    size_t count{ 0 };
+    for (auto property : properties.withPrefix(prefix))
+      count += property.first.size() > 0;
+    return count;
+  });
+}
+
+
+int main() {
+  std::string text{ makeCSV(1000000) };
+
+  const std::string fileName{ "benchmark.csv" };
+  std::ofstream(fileName, std::ios::out | std::ios::binary) << text;
+
+  benchmarkTokenizers(text);
+  benchmarkConversions();
+  benchmarkParallel(fileName, text.size());
+  benchmarkColumns(fileName);
+  benchmarkSelection();
+  benchmarkPrescan(text, fileName);
+  benchmarkCache(fileName, text.size());
+  benchmarkArena(fileName, text.size());
+  benchmarkIndex(fileName, text.size());
+  benchmarkMultiFiles(text);
+  benchmarkInputs(fileName, text.size());
+#ifdef FILE_READER_WITH_ZLIB
+  benchmarkCompressed(text, fileName);
+#endif
+  benchmarkProperties();
+
+  std::remove(fileName.c_str());
+}
@@ -0,0 +1,452 @@
+//  MIT License
+//
+//  Copyright (c) 2018 Francisco de Lanuza
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+
+#ifndef BLOCK_SOURCE_H
+#define BLOCK_SOURCE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <fstream>
+#include <climits>
+#include <cerrno>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef FILE_READER_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef FILE_READER_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+
+namespace utils
+{
+  /**
+    *  \brief Compression formats, recognized by the magic bytes at the start of a file
+    */
+  enum class Compression {
+    NONE,   ///< Not compressed
+    GZIP,   ///< gzip. Decompressed with zlib, if compiled with FILE_READER_WITH_ZLIB
+    ZSTD    ///< Zstandard. Decompressed with libzstd, if compiled with FILE_READER_WITH_ZSTD
+  };
+
+  /**
+    *  \brief Fills a buffer with the next bytes of an input, and returns the number of bytes written.
+    *         Fewer bytes than the size of the buffer are only written at the end of the input
+    */
+  using BlockSource = std::function<size_t(char* data, size_t size)>;
+
+  /**
+    *  \brief Sequential reader of a file
+    */
+  class FileSource
+  {
+  protected:
+    std::string _fileName;
+
+#ifdef _WIN32
+    std::ifstream _file;
+#else
+    int _fd{ -1 };
+#endif
+
+  public:
+    /**
+      *  \brief Constructor
+      *         Opens the file
+      *  @param fileName [in] Name of the file
+      *  @throw runtime_error File cannot be opened
+      */
+    explicit FileSource(const std::string& fileName);
+
+    FileSource(const FileSource&) = delete;
+    FileSource& operator=(const FileSource&) = delete;
+
+    ~FileSource();
+
+    /**
+      *  \brief Reads the next bytes of the file
+      *  @param data [out] Buffer where the bytes are written
+      *  @param size [in] Size of the buffer
+      *  @return  the number of bytes read. Less than size only at the end of the file
+      *  @throw runtime_error The file cannot be read
+      */
+    size_t operator()(char* data, size_t size);
+
+    /**
+      *  \brief Returns the name of the file
+      *  @return  the name of the file
+      */
+    const std::string& fileName() const { return _fileName; }
+  };
+
+#ifdef FILE_READER_WITH_ZLIB
+  /**
+    *  \brief Sequential reader of a gzip file, decompressing it on the fly. Concatenated members are read one after another
+    */
+  class GzipSource
+  {
+  protected:
+    BlockSource _source;     ///< Compressed input
+    std::string _name;       ///< Name of the input, for the error messages
+    std::vector<char> _input;
+    z_stream _stream{};
+    bool _eof{ false };      ///< The whole compressed file has been read
+    bool _member{ false };   ///< Inside a member, whose end has not been decompressed yet
+
+  public:
+    /**
+      *  \brief Constructor
+      *         Opens the file
+      *  @param fileName [in] Name of the file
+      *  @throw runtime_error File cannot be opened
+      */
+    explicit GzipSource(const std::string& fileName);
+
+    /**
+      *  \brief Constructor
+      *  @param source [in] Source of the compressed bytes
+      *  @param name [in] Name of the input, used in the error messages
+      *  @throw runtime_error The decompressor cannot be initialized
+      */
+    GzipSource(BlockSource source, const std::string& name);
+
+    GzipSource(const GzipSource&) = delete;
+    GzipSource& operator=(const GzipSource&) = delete;
+
+    ~GzipSource() { inflateEnd(&_stream); }
+
+    /**
+      *  \brief Decompresses the next bytes of the file
+      *  @param data [out] Buffer where the bytes are written
+      *  @param size [in] Size of the buffer
+      *  @return  the number of bytes written. Less than size only at the end of the file
+      *  @throw runtime_error The file cannot be read, is corrupted or truncated
+      */
+    size_t operator()(char* data, size_t size);
+  };
+#endif
+
+#ifdef FILE_READER_WITH_ZSTD
+  /**
+    *  \brief Sequential reader of a Zstandard file, decompressing it on the fly. Files with several frames are read frame after frame
+    */
+  class ZstdSource
+  {
+  protected:
+    BlockSource _source;     ///< Compressed input
+    std::string _name;       ///< Name of the input, for the error messages
+    std::vector<char> _input;
+    ZSTD_DStream* _stream;
+    ZSTD_inBuffer _in{ nullptr, 0, 0 };
+    bool _eof{ false };      ///< The whole compressed file has been read
+    bool _pending{ false };  ///< Inside a frame, whose end has not been decompressed yet
+
+  public:
+    /**
+      *  \brief Constructor
+      *         Opens the file
+      *  @param fileName [in] Name of the file
+      *  @throw runtime_error File cannot be opened
+      */
+    explicit ZstdSource(const std::string& fileName);
+
+    /**
+      *  \brief Constructor
+      *  @param source [in] Source of the compressed bytes
+      *  @param name [in] Name of the input, used in the error messages
+      *  @throw runtime_error The decompressor cannot be initialized
+      */
+    ZstdSource(BlockSource source, const std::string& name);
+
+    ZstdSource(const ZstdSource&) = delete;
+    ZstdSource& operator=(const ZstdSource&) = delete;
+
+    ~ZstdSource() { ZSTD_freeDStream(_stream); }
+
+    /**
+      *  \brief Decompresses the next bytes of the file
+      *  @param data [out] Buffer where the bytes are written
+      *  @param size [in] Size of the buffer
+      *  @return  the number of bytes written. Less than size only at the end of the file
+      *  @throw runtime_error The file cannot be read, is corrupted or truncated
+      */
+    size_t operator()(char* data, size_t size);
+  };
+#endif
+
+  /**
+    *  \brief Finds the compression format of a text from its first bytes
+    *  @param head [in] Start of the text
+    *  @return  the compression format
+    */
+  Compression detectCompression(std::string_view head);
+
+  /**
+    *  \brief Finds the compression format of a file from its first bytes
+    *  @param fileName [in] Name of the file
+    *  @return  the compression format. NONE if the file cannot be opened
+    */
+  Compression detectCompression(const std::string& fileName);
+
+  /**
+    *  \brief Returns a source of the bytes of a text in memory
+    *  @param data [in] The text. It must outlive the source
+    *  @return  the source of the text
+    */
+  BlockSource memorySource(std::string_view data);
+
+  /**
+    *  \brief Wraps a source of compressed bytes into a source of the decompressed bytes
+    *  @param compression [in] Compression format of the source
+    *  @param source [in] Source of the compressed bytes
+    *  @param name [in] Name of the input, used in the error messages
+    *  @return  the source of the decompressed bytes. source itself if it is not compressed
+    *  @throw runtime_error The format is not compiled in
+    */
+  BlockSource decompressSource(Compression compression, BlockSource source, const std::string& name);
+
+  /**
+    *  \brief Opens a file as a source of blocks. Compressed files are detected by their magic bytes, and decompressed on the fly.
+    *         The file is opened only once, so pipes can be read too
+    *  @param fileName [in] Name of the file
+    *  @return  the source of the content of the file
+    *  @throw runtime_error File cannot be opened, or it is compressed in a format not compiled in
+    */
+  BlockSource openSource(const std::string& fileName);
+
+
+  //*** DEFINITIONS ***********************************************************************************************************/
+  //***************************************************************************************************************************/
+
+  /// FILE SOURCE CONSTRUCTOR
+  inline FileSource::FileSource(const std::string& fileName) : _fileName{ fileName } {
+#ifdef _WIN32
+    _file.open(fileName, std::ios::in | std::ios::binary);
+    if (!_file.is_open())
+      throw std::runtime_error("File cannot be opened: " + fileName);
+#else
+    _fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if (_fd < 0)
+      throw std::runtime_error("File cannot be opened: " + fileName);
+#ifdef POSIX_FADV_SEQUENTIAL
+    ::posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#endif
+  }
+
+  /// FILE SOURCE DESTRUCTOR
+  inline FileSource::~FileSource() {
+#ifndef _WIN32
+    ::close(_fd);
+#endif
+  }
+
+  /// FILE SOURCE READ
+  inline size_t FileSource::operator()(char* data, size_t size) {
+#ifdef _WIN32
+    _file.read(data, std::streamsize(size));
+    if (_file.bad())
+      throw std::runtime_error("File cannot be read: " + _fileName);
+    return size_t(_file.gcount());
+#else
+    size_t filled{ 0 };
+    while (filled < size) {
+      ssize_t read{ ::read(_fd, data + filled, size - filled) };
+      if (read < 0) {
+        if (errno == EINTR) continue;
+        throw std::runtime_error("File cannot be read: " + _fileName);
+      }
+      if (read == 0) break;
+      filled += size_t(read);
+    }
+    return filled;
+#endif
+  }
+
+#ifdef FILE_READER_WITH_ZLIB
+  /// GZIP SOURCE CONSTRUCTOR
+  inline GzipSource::GzipSource(const std::string& fileName)
+    : GzipSource([file = std::make_shared<FileSource>(fileName)](char* data, size_t size) { return (*file)(data, size); }, fileName) {}
+
+  /// GZIP SOURCE CONSTRUCTOR FROM A SOURCE
+  inline GzipSource::GzipSource(BlockSource source, const std::string& name) : _source{ std::move(source) }, _name{ name }, _input(1 << 16) {
+    // Only the gzip format is accepted, not raw or zlib streams
+    if (inflateInit2(&_stream, 16 + MAX_WBITS) != Z_OK)
+      throw std::runtime_error("Compressed file cannot be read: " + name);
+  }
+
+  /// GZIP SOURCE READ
+  inline size_t GzipSource::operator()(char* data, size_t size) {
+    size_t written{ 0 };
+    while (written < size) {
+      if (!_stream.avail_in && !_eof) {
+        size_t read{ _source(_input.data(), _input.size()) };
+        _eof = read < _input.size();
+        _stream.next_in = reinterpret_cast<Bytef*>(_input.data());
+        _stream.avail_in = uInt(read);
+      }
+      if (!_stream.avail_in && _eof && !_member)
+        break;
+
+      uInt available{ uInt(std::min(size - written, size_t(UINT_MAX))) };
+      _stream.next_out = reinterpret_cast<Bytef*>(data + written);
+      _stream.avail_out = available;
+      int result{ inflate(&_stream, Z_NO_FLUSH) };
+      written += available - _stream.avail_out;
+
+      if (result == Z_STREAM_END) {
+        // Another member may follow
+        inflateReset(&_stream);
+        _member = false;
+      }
+      else if (result == Z_BUF_ERROR && !_stream.avail_in && _eof)
+        throw std::runtime_error("Compressed file truncated: " + _name);
+      else if (result != Z_OK && result != Z_BUF_ERROR)
+        throw std::runtime_error("Compressed file corrupted: " + _name);
+      else
+        _member = true;
+    }
+    return written;
+  }
+#endif
+
+#ifdef FILE_READER_WITH_ZSTD
+  /// ZSTD SOURCE CONSTRUCTOR
+  inline ZstdSource::ZstdSource(const std::string& fileName)
+    : ZstdSource([file = std::make_shared<FileSource>(fileName)](char* data, size_t size) { return (*file)(data, size); }, fileName) {}
+
+  /// ZSTD SOURCE CONSTRUCTOR FROM A SOURCE
+  inline ZstdSource::ZstdSource(BlockSource source, const std::string& name)
+    : _source{ std::move(source) }, _name{ name }, _input(ZSTD_DStreamInSize()), _stream{ ZSTD_createDStream() } {
+    if (!_stream || ZSTD_isError(ZSTD_initDStream(_stream))) {
+      ZSTD_freeDStream(_stream);
+      throw std::runtime_error("Compressed file cannot be read: " + name);
+    }
+  }
+
+  /// ZSTD SOURCE READ
+  inline size_t ZstdSource::operator()(char* data, size_t size) {
+    size_t written{ 0 };
+    while (written < size) {
+      if (_in.pos == _in.size && !_eof) {
+        size_t read{ _source(_input.data(), _input.size()) };
+        _eof = read < _input.size();
+        _in = ZSTD_inBuffer{ _input.data(), read, 0 };
+      }
+
+      // Called even without input, since the decompressed data may not have fit in the previous buffer
+      ZSTD_outBuffer out{ data + written, size - written, 0 };
+      size_t result{ ZSTD_decompressStream(_stream, &out, &_in) };
+      if (ZSTD_isError(result))
+        throw std::runtime_error("Compressed file corrupted: " + _name + ". " + ZSTD_getErrorName(result));
+      written += out.pos;
+      _pending = result != 0;
+
+      if (_in.pos == _in.size && _eof && (!_pending || !out.pos)) {
+        if (_pending)
+          throw std::runtime_error("Compressed file truncated: " + _name);
+        break;
+      }
+    }
+    return written;
+  }
+#endif
+
+  /// DETECT COMPRESSION
+  inline Compression detectCompression(std::string_view head) {
+    if (head.size() >= 2 && head[0] == '\x1f' && head[1] == '\x8b')
+      return Compression::GZIP;
+    if (head.size() >= 4 && head.substr(0, 4) == std::string_view("\x28\xb5\x2f\xfd", 4))
+      return Compression::ZSTD;
+    return Compression::NONE;
+  }
+
+  /// DETECT COMPRESSION OF A FILE
+  inline Compression detectCompression(const std::string& fileName) {
+    std::ifstream file(fileName, std::ios::in | std::ios::binary);
+    char head[4];
+    file.read(head, sizeof(head));
+    return detectCompression(std::string_view(head, size_t(file.gcount())));
+  }
+
+  /// MEMORY SOURCE
+  inline BlockSource memorySource(std::string_view data) {
+    return [rest = std::make_shared<std::string_view>(data)](char* dest, size_t size) {
+      size_t copied{ std::min(size, rest->size()) };
+      std::copy_n(rest->data(), copied, dest);
+      rest->remove_prefix(copied);
+      return copied;
+    };
+  }
+
+  /// DECOMPRESS SOURCE
+  inline BlockSource decompressSource(Compression compression, BlockSource source, const std::string& name) {
+    // std::function must be copyable, so the sources are shared
+    switch (compression) {
+    case Compression::GZIP:
+#ifdef FILE_READER_WITH_ZLIB
+      return [source = std::make_shared<GzipSource>(std::move(source), name)](char* data, size_t size) { return (*source)(data, size); };
+#else
+      throw std::runtime_error("Compressed file not supported: " + name + ". gzip needs compiling with FILE_READER_WITH_ZLIB");
+#endif
+    case Compression::ZSTD:
+#ifdef FILE_READER_WITH_ZSTD
+      return [source = std::make_shared<ZstdSource>(std::move(source), name)](char* data, size_t size) { return (*source)(data, size); };
+#else
+      throw std::runtime_error("Compressed file not supported: " + name + ". Zstandard needs compiling with FILE_READER_WITH_ZSTD");
+#endif
+    default:
+      return source;
+    }
+  }
+
+  /// OPEN SOURCE
+  inline BlockSource openSource(const std::string& fileName) {
+    // The first bytes, read to detect the compression, are returned before the rest of the file
+    auto file{ std::make_shared<FileSource>(fileName) };
+    auto head{ std::make_shared<std::string>(4, '\0') };
+    head->resize((*file)(head->data(), head->size()));
+    Compression compression{ detectCompression(std::string_view(*head)) };
+
+    BlockSource source{ [file, head](char* data, size_t size) {
+      size_t copied{ std::min(size, head->size()) };
+      std::copy_n(head->data(), copied, data);
+      head->erase(0, copied);
+      return copied < size ? copied + (*file)(data + copied, size - copied) : copied;
+    } };
+    return decompressSource(compression, std::move(source), fileName);
+  }
+}
+
+#endif // BLOCK_SOURCE_H
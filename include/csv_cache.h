@@ -0,0 +1,362 @@
+//  MIT License
+//
+//  Copyright (c) 2018 Francisco de Lanuza
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+
+#ifndef CSV_CACHE_H
+#define CSV_CACHE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <tuple>
+#include <type_traits>
+#include <fstream>
+#include <stdexcept>
+#include <filesystem>
+#include <system_error>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <atomic>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "file_buffer.h"
+
+
+namespace utils
+{
+  /**
+    *  \brief Identifies the content a cache file was built from. The cache is only valid while every field matches
+    */
+  struct CacheKey
+  {
+    std::string path;    ///< Name of the source file
+    uint64_t size{ 0 };  ///< Size of the source file in bytes
+    int64_t mtime{ 0 };  ///< Last modification time of the source file, in the ticks of the file system clock
+    std::string schema;  ///< Description of the types and options used to parse the source file
+
+    bool operator==(const CacheKey& other) const { return path == other.path && size == other.size && mtime == other.mtime && schema == other.schema; }
+  };
+
+  /**
+    *  \brief Builds the key of a source file
+    *  @param fileName [in] Name of the source file
+    *  @param schema [in] Description of the types and options used to parse it
+    *  @param key [out] The key
+    *  @return  false if the size or modification time of the file cannot be read
+    */
+  bool cacheKey(const std::string& fileName, std::string schema, CacheKey& key);
+
+  /**
+    *  \brief Returns a description of a list of value types, such as "i4f8s" for int, double, std::string
+    *  @return  one code per type: 'b' bool, 'i' signed, 'u' unsigned, 'f' floating point (followed by the size in bytes) or 's' string
+    */
+  template<class... TYPES>
+  std::string typeSignature();
+
+  /**
+    *  \brief Returns a temporary name for a file, unique to the process and call: "<fileName>.<pid>.<counter>.tmp"
+    *  @param fileName [in] Name of the file
+    *  @return  the temporary name
+    */
+  std::string temporaryName(const std::string& fileName);
+
+  /**
+    *  \brief Writes a binary file under a temporary name, and then renames it, so readers never see a partial file
+    *         and concurrent writers do not mix their content. The temporary file is removed on any failure
+    *  @param fileName [in] Name of the file
+    *  @param func [in] Callable object writing the content to the std::ofstream it receives
+    *  @return  false if the file cannot be written
+    */
+  template<class FUNC>
+  bool writeAtomically(const std::string& fileName, FUNC&& func);
+
+  /**
+    *  \brief Writes records to a binary cache file, with writeAtomically
+    *  @param cacheName [in] Name of the cache file
+    *  @param key [in] Key of the source of the records
+    *  @param records [in] Records to be written
+    *  @param header [in] Names of the columns of the source, stored along with the records
+    *  @return  false if the cache cannot be written
+    */
+  template<class... TYPES>
+  bool writeCache(const std::string& cacheName, const CacheKey& key, const std::vector<std::tuple<TYPES...>>& records, const std::vector<std::string>& header = {});
+
+  /**
+    *  \brief Reads the records of a binary cache file. The cache file is memory-mapped
+    *  @param cacheName [in] Name of the cache file
+    *  @param key [in] Key of the source of the records. The cache is discarded if its key does not match
+    *  @param records [out] Vector where the records are appended
+    *  @param header [out] If not null, names of the columns of the source
+    *  @return  false if the cache does not exist, cannot be read, is stale or is not valid. records and header are not modified in that case
+    */
+  template<class... TYPES>
+  bool readCache(const std::string& cacheName, const CacheKey& key, std::vector<std::tuple<TYPES...>>& records, std::vector<std::string>* header = nullptr);
+
+
+  /**
+    *  \brief Sequential reader of the content of a binary cache file, with bounds checking
+    */
+  class CacheCursor
+  {
+  protected:
+    const char* _pos;
+    const char* _end;
+
+  public:
+    explicit CacheCursor(std::string_view data) : _pos{ data.data() }, _end{ data.data() + data.size() } {}
+
+    /**
+      *  \brief Copies the next bytes
+      *  @param dest [out] Destination of the bytes
+      *  @param size [in] Number of bytes
+      *  @return  false if there are not enough bytes left
+      */
+    bool read(void* dest, size_t size) {
+      if (size_t(_end - _pos) < size) return false;
+      std::memcpy(dest, _pos, size);
+      _pos += size;
+      return true;
+    }
+
+    /**
+      *  \brief Reads a value of the given type. A bool is stored as one byte, 0 or 1
+      *  @param value [out] The value
+      *  @return  false if there are not enough bytes left or a bool byte is neither 0 nor 1
+      */
+    template<class TYPE>
+    bool read(TYPE& value) {
+      if constexpr (std::is_same<TYPE, std::string>::value) {
+        uint64_t size;
+        if (!read(&size, sizeof(size)) || uint64_t(_end - _pos) < size) return false;
+        value.assign(_pos, size_t(size));
+        _pos += size;
+        return true;
+      }
+      else if constexpr (std::is_same<TYPE, bool>::value) {
+        uint8_t byte;
+        if (!read(&byte, sizeof(byte)) || byte > 1) return false;
+        value = byte != 0;
+        return true;
+      }
+      else {
+        static_assert(std::is_arithmetic<TYPE>::value, "Type not supported ");
+        return read(&value, sizeof(TYPE));
+      }
+    }
+
+    /**
+      *  \brief Indicates whether all the content has been read
+      *  @return  true if there are no bytes left
+      */
+    bool end() const { return _pos == _end; }
+
+    /**
+      *  \brief Returns the number of bytes not read yet
+      *  @return  the number of bytes left
+      */
+    size_t remaining() const { return size_t(_end - _pos); }
+  };
+
+
+  //*** DEFINITIONS ***********************************************************************************************************/
+  //***************************************************************************************************************************/
+
+  /// Magic number and version of the cache format
+  constexpr char CACHE_MAGIC[8]{ 'F', 'R', 'C', 'A', 'C', 'H', 'E', '2' };
+
+  /// Written in native byte order, to detect caches built on machines of different endianness
+  constexpr uint32_t CACHE_BYTE_ORDER{ 0x01020304 };
+
+  /// CACHE KEY
+  inline bool cacheKey(const std::string& fileName, std::string schema, CacheKey& key) {
+    std::error_code error;
+    auto size{ std::filesystem::file_size(fileName, error) };
+    if (error) return false;
+    auto mtime{ std::filesystem::last_write_time(fileName, error) };
+    if (error) return false;
+
+    key.path = fileName;
+    key.size = uint64_t(size);
+    key.mtime = int64_t(mtime.time_since_epoch().count());
+    key.schema = std::move(schema);
+    return true;
+  }
+
+  /// TYPE SIGNATURE
+  template<class... TYPES>
+  std::string typeSignature() {
+    std::string signature;
+    auto add = [&signature](auto value) {
+      using TYPE = decltype(value);
+      if constexpr (std::is_same<TYPE, std::string>::value) signature += 's';
+      else if constexpr (std::is_same<TYPE, bool>::value) signature += 'b';
+      else {
+        signature += std::is_floating_point<TYPE>::value ? 'f' : std::is_signed<TYPE>::value ? 'i' : 'u';
+        signature += std::to_string(sizeof(TYPE));
+      }
+    };
+    (add(TYPES{}), ...);
+    return signature;
+  }
+
+  /// TEMPORARY NAME
+  inline std::string temporaryName(const std::string& fileName) {
+    static std::atomic<uint64_t> counter{ 0 };
+#ifdef _WIN32
+    const auto pid{ _getpid() };
+#else
+    const auto pid{ getpid() };
+#endif
+    return fileName + "." + std::to_string(pid) + "." + std::to_string(counter++) + ".tmp";
+  }
+
+  /// WRITE ATOMICALLY
+  template<class FUNC>
+  bool writeAtomically(const std::string& fileName, FUNC&& func) {
+    const std::string tmpName{ temporaryName(fileName) };
+    auto discard = [&tmpName]() {
+      std::error_code error;
+      std::filesystem::remove(tmpName, error);
+      return false;
+    };
+
+    try {
+      std::ofstream file(tmpName, std::ios::out | std::ios::binary | std::ios::trunc);
+      if (!file.is_open())
+        return discard();
+      func(file);
+      file.close();
+      if (!file)
+        return discard();
+    }
+    catch (...) {
+      discard();
+      throw;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmpName, fileName, error);
+    if (error)
+      return discard();
+    return true;
+  }
+
+  /// WRITE CACHE
+  template<class... TYPES>
+  bool writeCache(const std::string& cacheName, const CacheKey& key, const std::vector<std::tuple<TYPES...>>& records, const std::vector<std::string>& header) {
+    return writeAtomically(cacheName, [&](std::ofstream& file) {
+      auto write = [&file](const auto& value) {
+        using TYPE = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same<TYPE, std::string>::value) {
+          uint64_t size{ value.size() };
+          file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+          file.write(value.data(), std::streamsize(value.size()));
+        }
+        else if constexpr (std::is_same<TYPE, bool>::value) {
+          char byte{ value ? char(1) : char(0) };
+          file.write(&byte, 1);
+        }
+        else {
+          file.write(reinterpret_cast<const char*>(&value), sizeof(TYPE));
+        }
+      };
+
+      file.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+      write(CACHE_BYTE_ORDER);
+      write(key.path);
+      write(key.size);
+      write(key.mtime);
+      write(key.schema);
+      write(uint64_t(header.size()));
+      for (const auto& name : header)
+        write(name);
+      write(uint64_t(records.size()));
+      for (const auto& record : records)
+        std::apply([&write](const auto&... values) { (write(values), ...); }, record);
+    });
+  }
+
+  /// READ CACHE
+  template<class... TYPES>
+  bool readCache(const std::string& cacheName, const CacheKey& key, std::vector<std::tuple<TYPES...>>& records, std::vector<std::string>* header) {
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(cacheName, error))
+      return false;
+
+    // A cache which cannot be read, for instance without permission, is just missing
+    std::unique_ptr<FileBuffer> buffer;
+    try {
+      buffer = std::make_unique<FileBuffer>(cacheName);
+    }
+    catch (std::runtime_error&) {
+      return false;
+    }
+    CacheCursor cursor(buffer->view());
+
+    char magic[sizeof(CACHE_MAGIC)];
+    uint32_t byteOrder;
+    CacheKey cached;
+    uint64_t count;
+    if (!cursor.read(magic, sizeof(magic)) || std::memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0 ||
+        !cursor.read(byteOrder) || byteOrder != CACHE_BYTE_ORDER ||
+        !cursor.read(cached.path) || !cursor.read(cached.size) || !cursor.read(cached.mtime) || !cursor.read(cached.schema) ||
+        !(cached == key) || !cursor.read(count))
+      return false;
+
+    // Each name takes at least the bytes of its size
+    if (count > cursor.remaining() / sizeof(uint64_t))
+      return false;
+    std::vector<std::string> names(static_cast<size_t>(count));
+    for (auto& name : names)
+      if (!cursor.read(name))
+        return false;
+    if (!cursor.read(count))
+      return false;
+
+    // Each value takes at least one byte, so a bigger count can only come from a corrupted file
+    if (count > buffer->size())
+      return false;
+
+    std::vector<std::tuple<TYPES...>> result(static_cast<size_t>(count));
+    for (auto& record : result) {
+      bool valid{ std::apply([&cursor](auto&... values) { return (cursor.read(values) && ...); }, record) };
+      if (!valid)
+        return false;
+    }
+    if (!cursor.end())
+      return false;
+
+    records.insert(records.end(), std::make_move_iterator(result.begin()), std::make_move_iterator(result.end()));
+    if (header)
+      *header = std::move(names);
+    return true;
+  }
+}
+
+#endif // CSV_CACHE_H
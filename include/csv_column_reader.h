@@ -0,0 +1,223 @@
+//  MIT License
+//
+//  Copyright (c) 2018 Francisco de Lanuza
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+#ifndef CSV_COLUMN_READER_H
+#define CSV_COLUMN_READER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <tuple>
+#include <utility>
+
+#include "csv_file_reader.h"
+
+
+namespace utils
+{
+  /**
+    *  \brief Column-wise storage of CSV records: one contiguous vector per column
+    */
+  template<class... TYPES>
+  class CSVColumns
+  {
+  protected:
+    /**
+      *  One vector per column
+      */
+    std::tuple<std::vector<TYPES>...> _columns;
+
+    template<size_t... I>
+    void _reserve(size_t records, std::index_sequence<I...>) { (std::get<I>(_columns).reserve(records), ...); }
+
+    template<size_t... I>
+    void _shrink(std::index_sequence<I...>) { (std::get<I>(_columns).shrink_to_fit(), ...); }
+
+    template<size_t... I>
+    void _append(CSVColumns& other, std::index_sequence<I...>) { (appendRecords(std::get<I>(_columns), std::get<I>(other._columns)), ...); }
+
+    template<size_t... I>
+    void _push(const Tokens& tokens, size_t row, std::index_sequence<I...>) { (_pushValue<I>(tokens[I], row), ...); }
+
+    template<size_t I>
+    void _pushValue(std::string_view text, size_t row) {
+      typename std::tuple_element<I, std::tuple<TYPES...>>::type value{};
+      convertField(text, value, row, I);
+      std::get<I>(_columns).push_back(std::move(value));
+    }
+
+  public:
+    /**
+      *  \brief Returns the number of records
+      *  @return  the number of records
+      */
+    size_t size() const { return std::get<0>(_columns).size(); }
+
+    /**
+      *  \brief Reserves memory in every column
+      *  @param records [in] Number of records
+      */
+    void reserve(size_t records) { _reserve(records, std::index_sequence_for<TYPES...>{}); }
+
+    /**
+      *  \brief Releases the memory not used by the columns
+      */
+    void shrink_to_fit() { _shrink(std::index_sequence_for<TYPES...>{}); }
+
+    /**
+      *  \brief Converts the tokens of a record and appends the values to the columns
+      *  @param tokens [in] Tokens of the record
+      *  @param row [in] Record number, staring at 0. Used in error messages
+      *  @throw runtime_error Some value cannot be converted to its type
+      */
+    void push(const Tokens& tokens, size_t row) { _push(tokens, row, std::index_sequence_for<TYPES...>{}); }
+
+    /**
+      *  \brief Moves all the records of other to the end of the columns
+      *  @param other [in/out] Columns whose records are moved. They are left empty
+      */
+    void append(CSVColumns& other) { _append(other, std::index_sequence_for<TYPES...>{}); }
+
+    /**
+      *  \brief Returns the values of a column
+      *  @return  vector with the values of every record, in the order of the file
+      */
+    template<size_t I>
+    const auto& column() const { return std::get<I>(_columns); }
+  };
+
+  /// Overload of appendRecords, used to stitch the columns parsed by several threads
+  template<class... TYPES>
+  void appendRecords(CSVColumns<TYPES...>& records, CSVColumns<TYPES...>& other) { records.append(other); }
+
+
+  /**
+    *  \brief Columnar CSV file reader class. The field types are provided as template parameters.
+    *         The values of each column are stored in a contiguous vector, so scanning a column touches only its own values.
+    *         Each field is separated by a separator character.
+    *         Commented lines (starting with '#' or '!') are discarded.
+    *         Only ASCII characters are supported!
+    */
+  template<class... TYPES>
+  class CSVColumnReader
+  {
+  protected:
+    /**
+      *  Columns used to store in memory the content of the file
+      */
+    CSVColumns<TYPES...> _columns;
+
+    /**
+      *  \brief Parses the records in a text and appends them to the columns
+      *  @param tokenizer [in] Tokenizer to be used
+      *  @param text [in] One or more lines of the file
+      *  @param separator [in] Character used as value separator
+      *  @param columns [out] Columns where the records are appended
+      *  @param base [in] Number of records preceding the text
+      *  @return  the number of records read from the text
+      *  @throw range_error Some record does not contain the same number of values
+      */
+    static size_t _parse(SIMDTokenizer& tokenizer, std::string_view text, char separator, CSVColumns<TYPES...>& columns, size_t base);
+
+  public:
+    /**
+     *  \brief Constructor
+     *         Reads the file and initializes the columns
+     *  @param fileName [in] Name of the csv file
+     *  @param separator [in] Character used as value separator. By default is a ','
+     *  @param input [in] Input backend. By default the file is memory-mapped
+     *  @param threads [in] Number of threads parsing the file (only for CSVInput::MAPPED). '0' means one per hardware thread
+     *  @throw runtime_error File cannot be opened or some record does not contain the same number of values
+     */
+    CSVColumnReader(const std::string& fileName, char separator = ',', CSVInput input = CSVInput::MAPPED, size_t threads = 1);
+
+    /**
+      *  \brief Returns the total number of records in the csv file
+      *  @return  the number of records
+      */
+    size_t size() const { return _columns.size(); }
+
+    /**
+      *  \brief Returns the total number of values in a record
+      *  @return  the number of values
+      */
+    constexpr size_t cols() const { return sizeof...(TYPES); }
+
+    /**
+      *  \brief Returns all the values of a column, as a contiguous vector
+      *  @return  vector with the values of every record, in the order of the file
+      */
+    template<size_t I>
+    const auto& column() const { return _columns.template column<I>(); }
+  };
+
+
+  //*** DEFINITIONS ***********************************************************************************************************/
+  //***************************************************************************************************************************/
+
+  /// Private method _parse
+  template<class... TYPES>
+  size_t CSVColumnReader<TYPES...>::_parse(SIMDTokenizer& tokenizer, std::string_view text, char separator, CSVColumns<TYPES...>& columns, size_t base) {
+    size_t first{ columns.size() };
+
+    // Read each line, discarding empty ones or starting with '#' or '!'
+    tokenizer(text, separator, [&](const Tokens& tokens) {
+      std::string_view line{ tokens.line() };
+      if (line.length() == 0 || line[0] == '#' || line[0] == '!') return;
+
+      if (tokens.size() != sizeof...(TYPES)) {
+        auto line{ base + columns.size() - first + 1 };
+        throw std::range_error(std::string("Inconsistent CSV file. Line ") + std::to_string(line) + " contains " + std::to_string(tokens.size()) + " values. Expected " + std::to_string(sizeof...(TYPES)));
+      }
+
+      columns.push(tokens, base + columns.size() - first);
+    });
+    return columns.size() - first;
+  }
+
+  /// CONSTRUCTOR
+  template<class... TYPES>
+  CSVColumnReader<TYPES...>::CSVColumnReader(const std::string& fileName, char separator, CSVInput input, size_t threads) {
+    auto parse = [separator](SIMDTokenizer& tokenizer, std::string_view text, CSVColumns<TYPES...>& columns, size_t base) {
+      return _parse(tokenizer, text, separator, columns, base);
+    };
+
+    if (input == CSVInput::MAPPED) {
+      FileBuffer buffer(fileName);
+      // The lines are counted first, so every column is allocated at once
+      parseParallel(buffer.view(), threads, _columns, parse, 1);
+    }
+    else if (input == CSVInput::ASYNC) {
+      SIMDTokenizer tokenizer;
+      CSVOptions defaults;
+      readBlocks(fileName, separator, defaults.bufferSize, defaults.queueDepth, [&](std::string_view text) { parse(tokenizer, text, _columns, _columns.size()); });
+      _columns.shrink_to_fit();
+    }
+    else {
+      SIMDTokenizer tokenizer;
+      readLines(fileName, separator, [&](std::string_view line) { parse(tokenizer, line, _columns, _columns.size()); });
+      _columns.shrink_to_fit();
+    }
+  }
+}
+
+#endif // CSV_COLUMN_READER_H
@@ -24,15 +24,406 @@
 #define CSV_FILE_READER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <tuple>
 #include <type_traits>
 #include <exception>
+#include <stdexcept>
 #include <fstream>
+#include <memory>
+#include <iterator>
+#include <algorithm>
+#include <thread>
+#include <initializer_list>
+#include <functional>
+#include <optional>
+#include <memory_resource>
+#include <mutex>
+#include <unordered_map>
+
+#include "file_buffer.h"
+#include "csv_cache.h"
+#include "read_ahead.h"
+#include "simd_tokenizer.h"
+#include "string_converter.h"
 
 
 namespace utils
 {
+  /**
+    *  \brief Input backend used by the CSV readers to access the file
+    */
+  enum class CSVInput {
+    STREAM, ///< Line by line, through an input stream
+    MAPPED, ///< Memory-mapped. Falls back to reading the whole file into memory if it cannot be mapped (e.g. a pipe)
+    ASYNC   ///< In large blocks read ahead by a background thread, while the previous blocks are parsed
+  };
+
+  /**
+    *  \brief Calls func for each line of the file, read in blocks on the calling thread.
+    *         Lines ending inside a quoted value are joined with the next ones, so func receives whole records.
+    *         Compressed files are decompressed in blocks, and split into lines. The file is opened once, so it may be a pipe
+    *  @param fileName [in] Name of the file
+    *  @param separator [in] Character used as value separator
+    *  @param func [in] Callable object receiving each line as a string_view. If it returns a bool, the reading stops when it returns false
+    *  @throw runtime_error File cannot be opened or decompressed
+    */
+  template<class FUNC>
+  void readLines(const std::string& fileName, char separator, FUNC&& func);
+
+  /**
+    *  \brief Indicates whether a line is not a record: it is empty or commented (starting with '#' or '!')
+    *  @param line [in] Line, maybe ending with '\r'
+    *  @return  true if the line must be discarded
+    */
+  bool isBlankOrComment(std::string_view line);
+
+  /**
+    *  \brief Returns the number of values in the first record of a text, discarding empty and commented lines.
+    *         Separators inside quoted values are not counted
+    *  @param text [in] Text to be inspected
+    *  @param separator [in] Character used as value separator
+    *  @return  the number of values, or 0 if there are no records
+    */
+  size_t firstRecordSize(std::string_view text, char separator);
+
+  /**
+    *  \brief Splits a text in consecutive chunks of similar size. Each chunk, except maybe the last one, ends with a line break.
+    *         If the text contains quotes, line breaks preceded by an odd number of quotes are inside a quoted value and do not end a chunk
+    *  @param text [in] Text to be split
+    *  @param chunks [in] Maximum number of chunks
+    *  @return  the chunks, in the same order as in the text
+    */
+  std::vector<std::string_view> splitLines(std::string_view text, size_t chunks);
+
+  /**
+    *  \brief Moves all the records of a container to the end of another one
+    *  @param records [in/out] Container where the records are appended
+    *  @param other [in/out] Container whose records are moved. It is left empty
+    */
+  template<class RECORD>
+  void appendRecords(std::vector<RECORD>& records, std::vector<RECORD>& other);
+
+  /**
+    *  \brief Parses a text on several threads, each one working on a chunk of whole lines. The records are appended in the original order
+    *  @param text [in] Text to be parsed
+    *  @param threads [in] Number of threads. '0' means one per hardware thread
+    *  @param records [out] Container where the records are appended: a vector, or any class with size(), reserve() and an appendRecords overload
+    *  @param parse [in] Callable object parse(SIMDTokenizer&, std::string_view text, CONTAINER& records, size_t base) returning the number
+    *                    of records read from the text, where base is the number of records preceding the text (used for error messages)
+    *  @param prescan [in] Number of elements reserved in records per line, after counting the lines of the text. '0' means no reservation
+    *  @throw  the first exception thrown by parse, in the order of the text
+    */
+  template<class CONTAINER, class PARSE>
+  void parseParallel(std::string_view text, size_t threads, CONTAINER& records, PARSE&& parse, size_t prescan = 0);
+
+  /**
+    *  \brief Converts the value of a field to its type
+    *  @param text [in] Text of the field
+    *  @param value [out] Converted value
+    *  @param row [in] Record number, staring at 0. Used in error messages
+    *  @param col [in] Column number, staring at 0. Used in error messages
+    *  @throw runtime_error The value cannot be converted to its type
+    */
+  template<class TYPE>
+  void convertField(std::string_view text, TYPE& value, size_t row, size_t col);
+
+  /**
+    *  \brief Cast and copy the tokens of a record into a tuple.
+    *  @param tuple [out] tuple where the values must be copied into
+    *  @param tokens [in] Tokens of the record
+    *  @param row [in] Record number, staring at 0. Used in error messages
+    *  @throw runtime_error Some value cannot be converted to its type
+    */
+  template<size_t POS = 0, class... TYPES>
+  void copyToTuple(std::tuple<TYPES...>& tuple, const Tokens& tokens, size_t row, const size_t* columns = nullptr);
+
+
+  /**
+    *  \brief Columns to be read from a CSV file, in the order in which they must be stored.
+    *         The values of the rest of the columns are skipped, without being copied or converted.
+    */
+  class CSVSelection
+  {
+  protected:
+    /**
+      *  Selected column numbers, starting at 0
+      */
+    std::vector<size_t> _columns;
+
+  public:
+    CSVSelection(std::initializer_list<size_t> columns) : _columns(columns) {}
+    CSVSelection(std::vector<size_t> columns) : _columns(std::move(columns)) {}
+
+    /**
+      *  \brief Returns the number of selected columns
+      *  @return  the number of columns
+      */
+    size_t size() const { return _columns.size(); }
+
+    /**
+      *  \brief Returns the selected column numbers
+      *  @return  pointer to the first column number
+      */
+    const size_t* data() const { return _columns.data(); }
+
+    /**
+      *  \brief Returns the column of the file stored in the given position
+      *  @param pos [in] position in the selection, starting at 0
+      *  @return  the column number
+      */
+    size_t operator[](size_t pos) const { return _columns[pos]; }
+
+    /**
+      *  \brief Returns the minimum number of values a record must contain
+      *  @return  the highest selected column plus one
+      */
+    size_t required() const { return _columns.empty() ? 0 : *std::max_element(_columns.begin(), _columns.end()) + 1; }
+  };
+
+
+  /**
+    *  \brief Names of the columns of a CSV file, read from its header row.
+    *         A hash map from each name to its column is built once, so the columns can be resolved by name before reading the records
+    *         and the records themselves are only accessed by column number.
+    */
+  class CSVHeader
+  {
+  protected:
+    /**
+      *  Names of the columns, in the order of the file
+      */
+    std::vector<std::string> _names;
+
+    /**
+      *  Column number of each name. If a name is repeated, its first column
+      */
+    std::unordered_map<std::string, size_t> _columns;
+
+  public:
+    CSVHeader() = default;
+    CSVHeader(std::vector<std::string> names);
+
+    /**
+      *  \brief Returns the number of columns
+      *  @return  the number of names
+      */
+    size_t size() const { return _names.size(); }
+
+    /**
+      *  \brief Indicates whether there is no header
+      *  @return  true if there are no names
+      */
+    bool empty() const { return _names.empty(); }
+
+    /**
+      *  \brief Returns the names of the columns
+      *  @return  the names, in the order of the columns
+      */
+    const std::vector<std::string>& names() const { return _names; }
+
+    /**
+      *  \brief Returns the name of a column
+      *  @param col [in] column number, starting at 0
+      *  @return  the name
+      */
+    const std::string& operator[](size_t col) const { return _names[col]; }
+
+    /**
+      *  \brief Indicates whether some column has the given name
+      *  @param name [in] Name of the column
+      *  @return  true if the name is in the header
+      */
+    bool contains(std::string_view name) const { return _columns.count(std::string(name)) != 0; }
+
+    /**
+      *  \brief Returns the column with the given name
+      *  @param name [in] Name of the column
+      *  @return  the column number, starting at 0
+      *  @throw out_of_range No column has that name
+      */
+    size_t column(std::string_view name) const;
+
+    /**
+      *  \brief Resolves some names into the selection of their columns
+      *  @param names [in] Names of the columns, in the order in which they must be stored
+      *  @return  the selection
+      *  @throw runtime_error Some name is not in the header
+      */
+    CSVSelection select(const std::vector<std::string>& names) const;
+
+    /**
+      *  \brief Returns the header of the selected columns
+      *  @param selection [in] Selected columns
+      *  @return  the names of the selected columns, in the order of the selection
+      */
+    CSVHeader subset(const CSVSelection& selection) const;
+  };
+
+  /**
+    *  \brief Reads the header row: the first record of a text, discarding empty and commented lines. The names are trimmed
+    *  @param text [in] Text to be read
+    *  @param separator [in] Character used as value separator
+    *  @param header [out] Names of the columns. Empty if there are no records
+    *  @return  the position following the header in the text
+    */
+  size_t readHeader(std::string_view text, char separator, CSVHeader& header);
+
+  /**
+    *  \brief Reads the header row of a file through an input stream. Only the lines up to the header are read
+    *  @param fileName [in] Name of the file
+    *  @param separator [in] Character used as value separator
+    *  @return  the names of the columns. Empty if there are no records
+    *  @throw runtime_error File cannot be opened
+    */
+  CSVHeader readHeader(const std::string& fileName, char separator);
+
+
+  /**
+    *  \brief Predicate deciding whether a record must be loaded. It receives the raw tokens of the record, before any value is converted
+    */
+  using CSVFilter = std::function<bool(const Tokens&)>;
+
+  /**
+    *  \brief Builds a filter which only looks at the raw text of one column
+    *  @param col [in] Column number in the file, starting at 0
+    *  @param predicate [in] Callable object receiving the text of the column and returning true if the record must be loaded
+    *  @return  the filter
+    */
+  CSVFilter filterColumn(size_t col, std::function<bool(std::string_view)> predicate);
+
+
+  /**
+    *  \brief Options used to load a CSV file
+    */
+  struct CSVOptions
+  {
+    char separator;                         ///< Character used as value separator
+    CSVInput input;                         ///< Input backend
+    size_t threads;                         ///< Number of threads parsing the file (only for CSVInput::MAPPED). '0' means one per hardware thread
+    size_t cols;                            ///< Number of values in each record (only for a single value type). '0' means taken from the first record
+    std::optional<CSVSelection> selection;  ///< Columns to be read. All of them if empty
+    CSVFilter filter;                       ///< Records rejected by the filter are neither converted nor stored. Must be thread-safe if threads != 1
+    std::string cache;                      ///< Binary cache file of the parsed records (only for several value types). Not used if empty or with a filter
+    bool prescan{ true };                   ///< Counts the lines before parsing, to allocate the records at once (only for CSVInput::MAPPED and without a filter)
+    size_t bufferSize{ 1 << 20 };           ///< Size of the blocks read ahead (only for CSVInput::ASYNC)
+    size_t queueDepth{ 3 };                 ///< Number of blocks read ahead: 2 is double buffering, 3 triple buffering... (only for CSVInput::ASYNC)
+    bool header{ false };                   ///< The first record is a header row with the names of the columns. It is not loaded as a record
+    std::vector<std::string> names;         ///< Columns to be read, by their names in the header, instead of a selection. It is also the expected schema of the file
+
+    CSVOptions(char separator = ',', CSVInput input = CSVInput::MAPPED, size_t threads = 1, size_t cols = 0, std::optional<CSVSelection> selection = std::nullopt)
+      : separator{ separator }, input{ input }, threads{ threads }, cols{ cols }, selection{ std::move(selection) } {}
+  };
+
+
+  /**
+    *  \brief Indicates whether some of the value types is std::pmr::string, whose values are allocated in the arenas of the reader
+    */
+  template<class... TYPES>
+  struct uses_arena : std::disjunction<std::is_same<TYPES, std::pmr::string>...> {};
+
+  /**
+    *  \brief Arenas where the std::pmr::string values of a reader are allocated.
+    *         Each thread parsing a file allocates in its own arena, so no synchronization is needed per value.
+    *         The memory of an arena is released in a few large blocks when the last reader using it is destroyed.
+    */
+  class CSVArenas
+  {
+  protected:
+    /**
+      *  Arenas created so far. They are shared by the copies of a reader
+      */
+    std::vector<std::shared_ptr<std::pmr::monotonic_buffer_resource>> _arenas;
+
+    /**
+      *  Protects _arenas while several threads create arenas
+      */
+    std::mutex _mutex;
+
+  public:
+    /**
+      *  Size of the first block of each arena. Next blocks grow geometrically
+      */
+    static constexpr size_t BLOCK_SIZE{ 1 << 16 };
+
+    CSVArenas() = default;
+    CSVArenas(const CSVArenas& other) : _arenas{ other._arenas } {}
+    CSVArenas& operator=(const CSVArenas& other) { _arenas = other._arenas; return *this; }
+
+    /**
+      *  \brief Creates a new arena. Thread-safe
+      *  @return  the arena, valid as long as this object or a copy of it is alive
+      */
+    std::pmr::memory_resource* create();
+
+    /**
+      *  \brief Returns the number of arenas
+      *  @return  the number of arenas
+      */
+    size_t size() const { return _arenas.size(); }
+
+    /**
+      *  \brief Shares the arenas of another object, so they are kept alive as long as this object too
+      *  @param other [in] Object whose arenas are shared
+      */
+    void share(const CSVArenas& other);
+  };
+
+  /**
+    *  \brief Builds an empty record. Its std::pmr::string values, if any, are allocated in the given arena
+    *  @param arena [in] Arena for the std::pmr::string values. Not used if there are no such values
+    *  @return  the record
+    */
+  template<class... TYPES>
+  std::tuple<TYPES...> makeRecord(std::pmr::memory_resource* arena);
+
+
+  /**
+    *  \brief Checks that a record contains the expected number of values
+    *  @param tokens [in] Tokens of the record
+    *  @param selection [in] Columns to be read, or nullptr if all of them are read
+    *  @param numValues [in] Expected number of values
+    *  @param row [in] Record number, staring at 0
+    *  @throw range_error The record does not contain the expected number of values
+    */
+  void checkRecordSize(const Tokens& tokens, const CSVSelection* selection, size_t numValues, size_t row);
+
+  /**
+    *  \brief Reads the header row, if the options require it, and resolves the named columns into a selection
+    *  @param fileName [in] Name of the csv file
+    *  @param buffer [in] Content of the file, or nullptr to read the header through an input stream
+    *  @param options [in] Loading options
+    *  @param header [out] Names of the columns of the file. Empty if there is no header row
+    *  @param start [out] Position following the header in the buffer
+    *  @return  the options used to read the records, with the selection of the named columns
+    *  @throw invalid_argument Names are given without a header row, or together with a selection
+    *  @throw runtime_error Some name is not in the header
+    */
+  CSVOptions loadHeader(const std::string& fileName, const FileBuffer* buffer, const CSVOptions& options, CSVHeader& header, size_t& start);
+
+  /**
+    *  \brief Resolves the named columns into a selection
+    *  @param options [in] Loading options
+    *  @param header [in] Names of the columns of the file. Empty if there is no header row
+    *  @return  the options used to read the records, with the selection of the named columns
+    *  @throw invalid_argument Names are given without a header row, or together with a selection
+    *  @throw runtime_error Some name is not in the header
+    */
+  CSVOptions resolveHeader(const CSVOptions& options, const CSVHeader& header);
+
+  /**
+    *  \brief Checks that the header row contains the expected number of names
+    *  @param header [in] Names of the columns
+    *  @param numValues [in] Expected number of values, or '0' if it is not known yet
+    *  @throw range_error The header does not contain the expected number of names
+    */
+  void checkHeaderSize(const CSVHeader& header, size_t numValues);
+
+
+  template<class READER>
+  class CSVMultiLoader;
+
   /**
     *  \brief CSV file reader class. The field types are provided as template parameters. 
     *         Each field is separated by a separator character. 
@@ -42,18 +433,69 @@ namespace utils
   template<class... TYPES>
   class CSVFileReader {
   protected:
+    /**
+      *  Memory of the std::pmr::string values. Declared before _records, so it is released after them
+      */
+    CSVArenas _arenas;
+
     /**
       *  Vector used to store in memory the content of the file
       */
     std::vector<std::tuple<TYPES...>> _records;
 
     /**
-      *  \brief Cast and copy the string value in a vector into a tuple.
-      *  @param tuple [out] tuple where the values must be copied into
-      *  @param strValues [in] Vector containing the values as atrings
+      *  Names of the stored columns, if the file has a header row
       */
-    template<size_t POS = 0>
-    void _copyToTuple(std::tuple<TYPES...>& tuple, const std::vector<std::string>& strValues);
+    CSVHeader _header;
+
+    /**
+      *  \brief Parses the records in a text and appends them to a vector
+      *  @param tokenizer [in] Tokenizer to be used
+      *  @param text [in] One or more lines of the file
+      *  @param options [in] Separator, selected columns and filter
+      *  @param numValues [in/out] Number of values per record. If it is '0', it is set to the size of the first record
+      *  @param records [out] Vector where the records are appended
+      *  @param base [in] Number of records preceding the text, including the filtered ones
+      *  @param arena [in] Arena for the std::pmr::string values, or nullptr if there are no such values
+      *  @return  the number of records read from the text, including the filtered ones
+      *  @throw range_error Some record does not contain the same number of values
+      */
+    static size_t _parse(SIMDTokenizer& tokenizer, std::string_view text, const CSVOptions& options, size_t& numValues, std::vector<std::tuple<TYPES...>>& records, size_t base, std::pmr::memory_resource* arena);
+
+    /**
+      *  \brief Returns the number of values expected in each record: one per template parameter or, with a selection, as many as names in the header
+      *  @param options [in] Loading options, with the named columns resolved
+      *  @param header [in] Header of the file
+      *  @return  the number of values, or '0' if it must be taken from the first record
+      *  @throw range_error The header does not contain the expected number of names
+      */
+    static size_t _numValues(const CSVOptions& options, const CSVHeader& header);
+
+    /**
+      *  \brief Checks that the selected or named columns match the template parameters
+      *  @param options [in] Loading options
+      *  @throw invalid_argument The number of selected or named columns is not the number of template parameters
+      */
+    static void _checkOptions(const CSVOptions& options);
+
+    /**
+      *  \brief Reads the file and initializes the list of records
+      *  @param fileName [in] Name of the csv file
+      *  @param options [in] Loading options
+      *  @throw runtime_error File cannot be opened or some record does not contain the same number of values
+      */
+    void _load(const std::string& fileName, const CSVOptions& options);
+
+    /**
+      *  Whether the std::pmr::string values are allocated in arenas
+      */
+    static constexpr bool USES_ARENA{ uses_arena<TYPES...>::value };
+
+    /**
+      *  Empty reader, filled by CSVMultiLoader
+      */
+    CSVFileReader() = default;
+    friend class CSVMultiLoader<CSVFileReader>;
 
   public:
     /**
@@ -61,9 +503,39 @@ namespace utils
      *         Reads the file and initializes the list of records, each record is a vector of fields
      *  @param fileName [in] Name of the properties file
      *  @param separator [in] Character used as value separator. By default is a ','
+     *  @param input [in] Input backend. By default the file is memory-mapped
+     *  @param threads [in] Number of threads parsing the file (only for CSVInput::MAPPED). '0' means one per hardware thread
      *  @throw runtime_error File cannot be opened or some record does not contain the same number of values
      */
-    CSVFileReader(const std::string& fileName, char separator = ',');
+    CSVFileReader(const std::string& fileName, char separator = ',', CSVInput input = CSVInput::MAPPED, size_t threads = 1)
+      : CSVFileReader(fileName, CSVOptions{ separator, input, threads }) {}
+
+    /**
+     *  \brief Constructor
+     *         Reads only some columns of the file. The rest of the values are skipped without being converted
+     *  @param fileName [in] Name of the csv file
+     *  @param separator [in] Character used as value separator
+     *  @param selection [in] Columns to be read, one per template parameter, in the order of the template parameters
+     *  @param input [in] Input backend. By default the file is memory-mapped
+     *  @param threads [in] Number of threads parsing the file (only for CSVInput::MAPPED). '0' means one per hardware thread
+     *  @throw invalid_argument The number of selected columns is not the number of template parameters
+     *  @throw runtime_error File cannot be opened or some record does not contain the same number of values
+     */
+    CSVFileReader(const std::string& fileName, char separator, const CSVSelection& selection, CSVInput input = CSVInput::MAPPED, size_t threads = 1)
+      : CSVFileReader(fileName, CSVOptions{ separator, input, threads, 0, selection }) {}
+
+    /**
+     *  \brief Constructor
+     *         Reads the file with the given options. The cols option is ignored: every record must contain one value per template parameter,
+     *         or at least the selected columns. If a cache file is given and it was built from the same file, its records are read instead of
+     *         parsing the file. Otherwise, the cache is written after parsing the file.
+     *         The named columns are the expected schema: the header row must contain all of them, and they are read in the order of the names.
+     *  @param fileName [in] Name of the csv file
+     *  @param options [in] Loading options
+     *  @throw invalid_argument The number of selected or named columns is not the number of template parameters
+     *  @throw runtime_error File cannot be opened, some name is not in the header or some record does not contain the same number of values
+     */
+    CSVFileReader(const std::string& fileName, const CSVOptions& options);
 
     /**
       *  \brief Returns the total number of records in the csv file
@@ -77,6 +549,20 @@ namespace utils
       */
     constexpr size_t cols() const { return sizeof...(TYPES); }
 
+    /**
+      *  \brief Returns the names of the stored columns, in the order of the tuple. Empty if the file has no header row
+      *  @return  the header
+      */
+    const CSVHeader& header() const { return _header; }
+
+    /**
+      *  \brief Returns the position in the tuple of the column with the given name. Meant to be resolved once, before accessing the records
+      *  @param name [in] Name of the column in the header row
+      *  @return  the position, starting at 0
+      *  @throw out_of_range No column has that name
+      */
+    size_t column(std::string_view name) const { return _header.column(name); }
+
     /**
      *  \brief Returns an iterator to the first record
      *  @return  vector iterator
@@ -106,10 +592,73 @@ namespace utils
   class CSVFileReader<TYPE>
   {
   protected:
+    /**
+      *  Values of one record. If TYPE is std::pmr::string, both the vector and the strings are allocated in the arenas of the reader
+      */
+    using Record = typename std::conditional<uses_arena<TYPE>::value, std::pmr::vector<TYPE>, std::vector<TYPE>>::type;
+
+    /**
+      *  Memory of the std::pmr::string values. Declared before _records, so it is released after them
+      */
+    CSVArenas _arenas;
+
     /**
       *  Vector used to store in memory the content of the file
       */
-    std::vector<std::vector<TYPE>> _records;
+    std::vector<Record> _records;
+
+    /**
+      *  Names of the stored columns, if the file has a header row
+      */
+    CSVHeader _header;
+
+    /**
+      *  \brief Parses the records in a text and appends them to a vector
+      *  @param tokenizer [in] Tokenizer to be used
+      *  @param text [in] One or more lines of the file
+      *  @param options [in] Separator, selected columns and filter
+      *  @param numValues [in/out] Number of values per record. If it is '0', it is set to the size of the first record
+      *  @param records [out] Vector where the records are appended
+      *  @param base [in] Number of records preceding the text, including the filtered ones
+      *  @param arena [in] Arena for the records if TYPE is std::pmr::string, or nullptr
+      *  @return  the number of records read from the text, including the filtered ones
+      *  @throw range_error Some record does not contain the same number of values
+      */
+    static size_t _parse(SIMDTokenizer& tokenizer, std::string_view text, const CSVOptions& options, size_t& numValues, std::vector<Record>& records, size_t base, std::pmr::memory_resource* arena);
+
+    /**
+      *  \brief Returns the number of values expected in each record: the cols option or, with a header, as many as names
+      *  @param options [in] Loading options, with the named columns resolved
+      *  @param header [in] Header of the file
+      *  @return  the number of values, or '0' if it must be taken from the first record
+      *  @throw range_error The header does not contain the expected number of names
+      */
+    static size_t _numValues(const CSVOptions& options, const CSVHeader& header);
+
+    /**
+      *  \brief Checks the options. Any number of columns can be selected or named
+      *  @param options [in] Loading options
+      */
+    static void _checkOptions(const CSVOptions&) {}
+
+    /**
+      *  \brief Reads the file and initializes the list of records
+      *  @param fileName [in] Name of the csv file
+      *  @param options [in] Loading options
+      *  @throw runtime_error File cannot be opened or some record does not contain the same number of values
+      */
+    void _load(const std::string& fileName, const CSVOptions& options);
+
+    /**
+      *  Whether the std::pmr::string values are allocated in arenas
+      */
+    static constexpr bool USES_ARENA{ uses_arena<TYPE>::value };
+
+    /**
+      *  Empty reader, filled by CSVMultiLoader
+      */
+    CSVFileReader() = default;
+    friend class CSVMultiLoader<CSVFileReader>;
 
   public:
     /**
@@ -119,9 +668,36 @@ namespace utils
       *  @param separator [in] Character used as value separator. By default is a ','
       *  @param cols [in] Number of values in each record. Default value '0' means that it will be based on the content of the csv file. 
                           All records must have the same number of values.
+      *  @param input [in] Input backend. By default the file is memory-mapped
+      *  @param threads [in] Number of threads parsing the file (only for CSVInput::MAPPED). '0' means one per hardware thread
       *  @throw runtime_error File cannot be opened or some record does not contain the same number of values
       */
-    CSVFileReader(const std::string& fileName, char separator = ',', size_t cols = 0);
+    CSVFileReader(const std::string& fileName, char separator = ',', size_t cols = 0, CSVInput input = CSVInput::MAPPED, size_t threads = 1)
+      : CSVFileReader(fileName, CSVOptions{ separator, input, threads, cols }) {}
+
+    /**
+      *  \brief Constructor
+      *         Reads only some columns of the file. The rest of the values are skipped without being copied or converted.
+      *         All records must have the same number of values.
+      *  @param fileName [in] Name of the csv file
+      *  @param separator [in] Character used as value separator
+      *  @param selection [in] Columns to be read, in the order in which they must be stored
+      *  @param input [in] Input backend. By default the file is memory-mapped
+      *  @param threads [in] Number of threads parsing the file (only for CSVInput::MAPPED). '0' means one per hardware thread
+      *  @throw runtime_error File cannot be opened or some record does not contain the same number of values
+      */
+    CSVFileReader(const std::string& fileName, char separator, const CSVSelection& selection, CSVInput input = CSVInput::MAPPED, size_t threads = 1)
+      : CSVFileReader(fileName, CSVOptions{ separator, input, threads, 0, selection }) {}
+
+    /**
+      *  \brief Constructor
+      *         Reads the file with the given options. If a selection or named columns are given, the cols option is ignored.
+      *  @param fileName [in] Name of the csv file
+      *  @param options [in] Loading options
+      *  @throw invalid_argument Names are given without a header row, or together with a selection
+      *  @throw runtime_error File cannot be opened, some name is not in the header or some record does not contain the same number of values
+      */
+    CSVFileReader(const std::string& fileName, const CSVOptions& options) { _load(fileName, options); }
         
     /**
       *  \brief Returns the total number of records in the csv file
@@ -135,6 +711,20 @@ namespace utils
       */
     size_t cols() const { return _records[0].size(); }
 
+    /**
+      *  \brief Returns the names of the stored columns, in the order of the records. Empty if the file has no header row
+      *  @return  the header
+      */
+    const CSVHeader& header() const { return _header; }
+
+    /**
+      *  \brief Returns the position in the records of the column with the given name. Meant to be resolved once, before accessing the records
+      *  @param name [in] Name of the column in the header row
+      *  @return  the position, starting at 0
+      *  @throw out_of_range No column has that name
+      */
+    size_t column(std::string_view name) const { return _header.column(name); }
+
     /**
      *  \brief Returns an iterator to the first record
      *  @return  vector iterator
@@ -157,6 +747,187 @@ namespace utils
   };
 
   using CSVFileReaderStr = CSVFileReader<std::string>;
+
+
+  /**
+    *  \brief CSV file reader class. Specialization for records where all the values are string_views.
+    *         The file buffer is kept alive by the reader and each value is a view into it, so no memory is allocated per value.
+    *         The position of the values is stored in a single flat table of offsets.
+    */
+  template<>
+  class CSVFileReader<std::string_view>
+  {
+  public:
+    /**
+      *  \brief View of one record of the file
+      */
+    class Record
+    {
+    protected:
+      const char* _data{ nullptr };
+      const size_t* _offsets{ nullptr };
+      size_t _cols{ 0 };
+
+    public:
+      /**
+        *  \brief Iterator through the values of a record
+        */
+      class iterator
+      {
+      protected:
+        const Record* _record;
+        size_t _col;
+        std::string_view _value;
+
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const std::string_view*;
+        using reference = const std::string_view&;
+
+        iterator(const Record* record, size_t col) : _record{ record }, _col{ col } { if (_col < _record->size()) _value = (*_record)[_col]; }
+        reference operator*() const { return _value; }
+        pointer operator->() const { return &_value; }
+        iterator& operator++() { if (++_col < _record->size()) _value = (*_record)[_col]; return *this; }
+        iterator operator++(int) { iterator it{ *this }; ++(*this); return it; }
+        bool operator==(const iterator& other) const { return _col == other._col; }
+        bool operator!=(const iterator& other) const { return _col != other._col; }
+      };
+
+      Record() = default;
+      Record(const char* data, const size_t* offsets, size_t cols) : _data{ data }, _offsets{ offsets }, _cols{ cols } {}
+
+      /**
+        *  \brief Returns the number of values in the record
+        *  @return  the number of values
+        */
+      size_t size() const { return _cols; }
+
+      /**
+        *  \brief Returns the value in the specified column. Quoted values are returned without the enclosing quotes,
+        *         but their escaped quotes ("") are not unescaped, since the view points into the file
+        *  @param col [in] column number, starting at 0
+        *  @return  a view of the value, valid while the file buffer is alive
+        */
+      std::string_view operator[](size_t col) const {
+        std::string_view value(_data + _offsets[col], _offsets[col + 1] - _offsets[col] - 1);
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+          return value.substr(1, value.size() - 2);
+        return value;
+      }
+
+      iterator begin() const { return iterator(this, 0); }
+      iterator end() const { return iterator(this, _cols); }
+    };
+
+    /**
+      *  \brief Iterator through the records of the file
+      */
+    class iterator
+    {
+    protected:
+      const CSVFileReader* _reader;
+      size_t _row;
+      Record _record;
+
+    public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = Record;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const Record*;
+      using reference = const Record&;
+
+      iterator(const CSVFileReader* reader, size_t row) : _reader{ reader }, _row{ row } { if (_row < _reader->size()) _record = (*_reader)[_row]; }
+      reference operator*() const { return _record; }
+      pointer operator->() const { return &_record; }
+      iterator& operator++() { if (++_row < _reader->size()) _record = (*_reader)[_row]; return *this; }
+      iterator operator++(int) { iterator it{ *this }; ++(*this); return it; }
+      bool operator==(const iterator& other) const { return _row == other._row; }
+      bool operator!=(const iterator& other) const { return _row != other._row; }
+    };
+
+  protected:
+    /**
+      *  Content of the file. All the values are views into this buffer
+      */
+    std::shared_ptr<const FileBuffer> _buffer;
+
+    /**
+      *  Offsets of the values in the buffer. Each record takes (cols + 1) offsets: the start of each value, 
+      *  plus one past the separator following the last value
+      */
+    std::vector<size_t> _offsets;
+
+    /**
+      *  Number of values per record
+      */
+    size_t _cols{ 0 };
+
+    /**
+      *  \brief Indexes the values of the records in a text
+      *  @param tokenizer [in] Tokenizer to be used
+      *  @param text [in] One or more lines of the file, inside the file buffer
+      *  @param separator [in] Character used as value separator
+      *  @param offsets [out] Vector where the offsets of the values are appended
+      *  @param base [in] Number of records preceding the text
+      *  @return  the number of records indexed
+      *  @throw range_error Some record does not contain the same number of values
+      */
+    size_t _index(SIMDTokenizer& tokenizer, std::string_view text, char separator, std::vector<size_t>& offsets, size_t base) const;
+
+  public:
+    /**
+      *  \brief Constructor
+      *         Maps the file into memory and indexes the position of every value
+      *  @param fileName [in] Name of the properties file
+      *  @param separator [in] Character used as value separator. By default is a ','
+      *  @param cols [in] Number of values in each record. Default value '0' means that it will be based on the content of the csv file. 
+                          All records must have the same number of values.
+      *  @param threads [in] Number of threads indexing the file. '0' means one per hardware thread
+      *  @throw runtime_error File cannot be opened or some record does not contain the same number of values
+      */
+    CSVFileReader(const std::string& fileName, char separator = ',', size_t cols = 0, size_t threads = 1);
+
+    /**
+      *  \brief Returns the total number of records in the csv file
+      *  @return  the number of records
+      */
+    size_t size() const { return _cols ? _offsets.size() / (_cols + 1) : 0; }
+
+    /**
+      *  \brief Returns the total number of values in a record
+      *  @return  the number of values
+      */
+    size_t cols() const { return _cols; }
+
+    /**
+     *  \brief Returns an iterator to the first record
+     *  @return  record iterator
+     */
+    iterator begin() const { return iterator(this, 0); }
+
+    /**
+     *  \brief Returns an iterator past the last record
+     *  @return  record iterator
+     */
+    iterator end() const { return iterator(this, size()); }
+
+    /**
+    *  \brief Returns a view of the specified record
+    *  @param row [in] record number, staring at 0
+    *  @return  a record view
+    */
+    Record operator[](size_t row) const { return Record(_buffer->data(), _offsets.data() + row * (_cols + 1), _cols); }
+
+    /**
+    *  \brief Returns the file buffer. The values remain valid as long as the buffer is alive, even after the reader is destroyed
+    *  @return  shared pointer to the buffer
+    */
+    std::shared_ptr<const FileBuffer> buffer() const { return _buffer; }
+  };
+
+  using CSVView = CSVFileReader<std::string_view>;
     
 
   /**
@@ -167,139 +938,733 @@ namespace utils
   public:
     Tokenizer() {};
     /**
-      *  \brief operator() --> tokenizes a string according to the given separator character, and returns a vector of token strings
+      *  \brief operator() --> tokenizes a string according to the given separator character, and returns a vector of token strings.
+      *         Quoted values are returned without the enclosing quotes and with their escaped quotes unescaped
       *  @param tokens [out] reference to the vector of string to be used to return the tokens
       *  @param str [in] string to be tokenized
       *  @param sep [in] token separator character
       *  @return void
       */
-    void operator() (std::vector<std::string> &tokens, const std::string &str, const char sep);
+    void operator() (std::vector<std::string> &tokens, std::string_view str, const char sep);
   };
 
 
   //*** DEFINITIONS ***********************************************************************************************************/
   //***************************************************************************************************************************/
 
-  /// Private method _copyToTuple
-  template<class... TYPES>
-  template<size_t POS>
-  void CSVFileReader<TYPES...>::_copyToTuple(std::tuple<TYPES...>& tuple, const std::vector<std::string>& strValues) {
+  /// CONVERT FIELD
+  template<class TYPE>
+  void convertField(std::string_view text, TYPE& value, size_t row, size_t col) {
+    if (!fromString(text, value))
+      throw std::runtime_error(std::string("Invalid CSV value. Line ") + std::to_string(row + 1) + ", column " + std::to_string(col + 1) + ": '" + std::string(text) + "'");
+  }
+
+  /// COPY TO TUPLE
+  template<size_t POS, class... TYPES>
+  void copyToTuple(std::tuple<TYPES...>& tuple, const Tokens& tokens, size_t row, const size_t* columns) {
     using VAL_TYPE = typename std::tuple_element<POS, std::tuple<TYPES...>>::type;
-    static_assert(std::is_arithmetic<VAL_TYPE>::value || std::is_same<VAL_TYPE, std::string>::value, "Type not supported ");
-    if constexpr (std::is_same<VAL_TYPE, std::string>::value) {
-      std::get<POS>(tuple) = strValues[POS];
+    static_assert(is_convertible_value<VAL_TYPE>::value, "Type not supported ");
+    size_t col{ columns ? columns[POS] : POS };
+    convertField(tokens[col], std::get<POS>(tuple), row, col);
+
+    if constexpr ((POS + 1) < sizeof...(TYPES))
+      copyToTuple<POS + 1>(tuple, tokens, row, columns);
+  }
+
+  /// READ LINES
+  template<class FUNC>
+  void readLines(const std::string& fileName, char separator, FUNC&& func) {
+    // The input is opened only once, so pipes can be read too
+    BlockSource source{ openSource(fileName) };
+    std::vector<char> buffer(1 << 16);
+    bool eof{ false };
+    auto next = [&source, &buffer, &eof]() {
+      if (eof)
+        return std::string_view();
+      size_t read{ source(buffer.data(), buffer.size()) };
+      eof = read < buffer.size();
+      return std::string_view(buffer.data(), read);
+    };
+
+    RecordScanner scanner(separator);
+    splitRecords(next, separator, [&](std::string_view text) {
+      // The blocks contain whole records
+      while (!text.empty()) {
+        size_t end{ scanner.scan(text) };
+        std::string_view line{ text.substr(0, end) };
+        text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+        if constexpr (std::is_same<decltype(func(line)), bool>::value) {
+          if (!func(line)) return false;
+        }
+        else
+          func(line);
+      }
+      return true;
+    });
+  }
+
+  /// IS BLANK OR COMMENT
+  inline bool isBlankOrComment(std::string_view line) {
+    if (line.length() && line.back() == '\r') line.remove_suffix(1);
+    return line.length() == 0 || line[0] == '#' || line[0] == '!';
+  }
+
+  /// FIRST RECORD SIZE
+  inline size_t firstRecordSize(std::string_view text, char separator) {
+    size_t pos{ 0 };
+    while (pos < text.size()) {
+      size_t eol{ std::min(text.find('\n', pos), text.size()) };
+      std::string_view line{ text.substr(pos, eol - pos) };
+      if (line.length() && line.back() == '\r') line.remove_suffix(1);
+      if (line.length() && line[0] != '#' && line[0] != '!') {
+        if (text.find('"', pos) == std::string_view::npos)
+          return size_t(std::count(line.begin(), line.end(), separator)) + 1;
+
+        // The record may contain quoted values, so its separators are counted until it ends
+        size_t values{ 1 };
+        bool quoted{ false };
+        size_t valueStart{ pos };
+        for (size_t i = pos; i < text.size(); ++i) {
+          char c{ text[i] };
+          if (quoted) {
+            if (c == '"') {
+              if (i + 1 < text.size() && text[i + 1] == '"') ++i;
+              else quoted = false;
+            }
+          }
+          else if (c == '\n')
+            break;
+          else if (c == separator) {
+            ++values;
+            valueStart = i + 1;
+          }
+          else if (c == '"' && i == valueStart)
+            quoted = true;
+        }
+        return values;
+      }
+      pos = eol + 1;
     }
+    return 0;
+  }
+
+  /// SPLIT LINES
+  inline std::vector<std::string_view> splitLines(std::string_view text, size_t chunks) {
+    std::vector<std::string_view> result;
+    // Without quotes, any line break ends a record
+    bool quotes{ chunks > 1 && text.find('"') != std::string_view::npos };
+    size_t counted{ 0 };
+    bool quoted{ false };
+    size_t start{ 0 };
+    for (size_t i = 1; i <= chunks && start < text.size(); ++i) {
+      size_t end{ i == chunks ? text.size() : std::max(start, text.size() / chunks * i) };
+      // Move the end of the chunk after the next line break
+      if (end < text.size()) {
+        end = text.find('\n', end);
+        // Skip the line breaks inside quoted values, preceded by an odd number of quotes
+        while (quotes && end != std::string_view::npos) {
+          quoted ^= (std::count(text.begin() + counted, text.begin() + end, '"') & 1) != 0;
+          counted = end;
+          if (!quoted) break;
+          end = text.find('\n', end + 1);
+        }
+        end = std::min(end, text.size() - 1) + 1;
+      }
+      result.push_back(text.substr(start, end - start));
+      start = end;
+    }
+    return result;
+  }
+
+  /// APPEND RECORDS
+  template<class RECORD>
+  void appendRecords(std::vector<RECORD>& records, std::vector<RECORD>& other) {
+    records.insert(records.end(), std::make_move_iterator(other.begin()), std::make_move_iterator(other.end()));
+    std::vector<RECORD>().swap(other);
+  }
+
+  /// PARSE PARALLEL
+  template<class CONTAINER, class PARSE>
+  void parseParallel(std::string_view text, size_t threads, CONTAINER& records, PARSE&& parse, size_t prescan) {
+    if (!threads)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::string_view> chunks{ splitLines(text, threads) };
+    if (chunks.size() <= 1) {
+      SIMDTokenizer tokenizer;
+      if (prescan)
+        records.reserve(records.size() + SIMDTokenizer::countLines(text) * prescan);
+      parse(tokenizer, text, records, 0);
+      return;
+    }
+
+    // Each chunk is parsed on its own thread, into its own vector
+    std::vector<CONTAINER> results(chunks.size());
+    std::vector<size_t> counts(chunks.size());
+    std::vector<std::exception_ptr> errors(chunks.size());
+    std::vector<std::thread> workers;
+    workers.reserve(chunks.size());
+    try {
+      for (size_t i = 0; i < chunks.size(); ++i) {
+        workers.emplace_back([&, i]() {
+          try {
+            SIMDTokenizer tokenizer;
+            if (prescan)
+              results[i].reserve(SIMDTokenizer::countLines(chunks[i]) * prescan);
+            counts[i] = parse(tokenizer, chunks[i], results[i], 0);
+          }
+          catch (...) {
+            errors[i] = std::current_exception();
+          }
+        });
+      }
+    }
+    catch (...) {
+      for (auto& worker : workers) worker.join();
+      throw;
+    }
+    for (auto& worker : workers) worker.join();
+
+    // Stitch the results in the original order
+    size_t total{ records.size() };
+    for (auto& result : results) total += result.size();
+    records.reserve(total);
+    size_t base{ 0 };
+    for (size_t i = 0; i < chunks.size(); ++i) {
+      if (errors[i]) {
+        // Parse the chunk again knowing how many records precede it, so the error refers to the right record
+        SIMDTokenizer tokenizer;
+        CONTAINER discarded;
+        parse(tokenizer, chunks[i], discarded, base);
+        std::rethrow_exception(errors[i]);
+      }
+      appendRecords(records, results[i]);
+      base += counts[i];
+    }
+  }
+
+  /// CHECK RECORD SIZE
+  inline void checkRecordSize(const Tokens& tokens, const CSVSelection* selection, size_t numValues, size_t row) {
+    if (tokens.size() != numValues)
+      throw std::range_error(std::string("Inconsistent CSV file. Line ") + std::to_string(row + 1) + " contains " + std::to_string(tokens.size()) + " values. Expected " + std::to_string(numValues));
+    if (selection && tokens.size() < selection->required())
+      throw std::range_error(std::string("Inconsistent CSV file. Line ") + std::to_string(row + 1) + " contains " + std::to_string(tokens.size()) + " values. Expected at least " + std::to_string(selection->required()));
+  }
+
+  /// CREATE ARENA
+  inline std::pmr::memory_resource* CSVArenas::create() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _arenas.emplace_back(std::make_shared<std::pmr::monotonic_buffer_resource>(BLOCK_SIZE)).get();
+  }
+
+  /// SHARE ARENAS
+  inline void CSVArenas::share(const CSVArenas& other) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _arenas.insert(_arenas.end(), other._arenas.begin(), other._arenas.end());
+  }
+
+  /// MAKE RECORD
+  template<class... TYPES>
+  std::tuple<TYPES...> makeRecord(std::pmr::memory_resource* arena) {
+    if constexpr (uses_arena<TYPES...>::value)
+      return std::tuple<TYPES...>(std::allocator_arg, std::pmr::polymorphic_allocator<char>(arena));
     else {
-      if constexpr (std::is_floating_point<VAL_TYPE>::value)
-        std::get<POS>(tuple) = VAL_TYPE(atof(strValues[POS].c_str()));
-      else if constexpr (sizeof(VAL_TYPE) > sizeof(int))
-        std::get<POS>(tuple) = VAL_TYPE(atol(strValues[POS].c_str()));
+      (void)arena;
+      return std::tuple<TYPES...>();
+    }
+  }
+
+  /// FILTER COLUMN
+  inline CSVFilter filterColumn(size_t col, std::function<bool(std::string_view)> predicate) {
+    return [col, predicate{ std::move(predicate) }](const Tokens& tokens) { return predicate(tokens[col]); };
+  }
+
+  /// HEADER CONSTRUCTOR
+  inline CSVHeader::CSVHeader(std::vector<std::string> names) : _names(std::move(names)) {
+    _columns.reserve(_names.size());
+    for (size_t col = 0; col < _names.size(); ++col)
+      _columns.emplace(_names[col], col);
+  }
+
+  /// HEADER COLUMN
+  inline size_t CSVHeader::column(std::string_view name) const {
+    auto it{ _columns.find(std::string(name)) };
+    if (it == _columns.end())
+      throw std::out_of_range("CSV column not found: '" + std::string(name) + "'");
+    return it->second;
+  }
+
+  /// HEADER SELECT
+  inline CSVSelection CSVHeader::select(const std::vector<std::string>& names) const {
+    std::vector<size_t> columns;
+    columns.reserve(names.size());
+    for (const auto& name : names) {
+      auto it{ _columns.find(name) };
+      if (it == _columns.end())
+        throw std::runtime_error("Invalid CSV header. Column not found: '" + name + "'");
+      columns.push_back(it->second);
+    }
+    return CSVSelection(std::move(columns));
+  }
+
+  /// HEADER SUBSET
+  inline CSVHeader CSVHeader::subset(const CSVSelection& selection) const {
+    std::vector<std::string> names;
+    names.reserve(selection.size());
+    for (size_t i = 0; i < selection.size(); ++i)
+      names.push_back(selection[i] < _names.size() ? _names[selection[i]] : std::string());
+    return CSVHeader(std::move(names));
+  }
+
+  /// READ HEADER
+  inline size_t readHeader(std::string_view text, char separator, CSVHeader& header) {
+    size_t pos{ 0 };
+    while (pos < text.size()) {
+      size_t eol{ std::min(text.find('\n', pos), text.size()) };
+      std::string_view line{ text.substr(pos, eol - pos) };
+      if (line.length() && line.back() == '\r') line.remove_suffix(1);
+      if (line.length() && line[0] != '#' && line[0] != '!') {
+        // The names may be quoted, and contain line breaks
+        RecordScanner scanner(separator);
+        size_t end{ scanner.scan(text.substr(pos)) };
+        end = end == std::string_view::npos ? text.size() : pos + end;
+
+        std::vector<std::string> names;
+        SIMDTokenizer tokenizer;
+        tokenizer(text.substr(pos, end - pos), separator, [&names](const Tokens& tokens) {
+          for (size_t i = 0; i < tokens.size(); ++i)
+            names.emplace_back(trimBlanks(tokens[i]));
+        });
+        header = CSVHeader(std::move(names));
+        return std::min(end + 1, text.size());
+      }
+      pos = eol + 1;
+    }
+    header = CSVHeader();
+    return text.size();
+  }
+
+  /// READ HEADER FROM A STREAM
+  inline CSVHeader readHeader(const std::string& fileName, char separator) {
+    CSVHeader header;
+    // Empty and commented lines give an empty header, so the reading goes on
+    readLines(fileName, separator, [&header, separator](std::string_view line) {
+      readHeader(line, separator, header);
+      return header.empty();
+    });
+    return header;
+  }
+
+  /// LOAD HEADER
+  inline CSVOptions loadHeader(const std::string& fileName, const FileBuffer* buffer, const CSVOptions& options, CSVHeader& header, size_t& start) {
+    start = 0;
+    if (options.header) {
+      if (buffer)
+        start = readHeader(buffer->view(), options.separator, header);
       else
-        std::get<POS>(tuple) = VAL_TYPE(atoi(strValues[POS].c_str()));
+        header = readHeader(fileName, options.separator);
     }
+    return resolveHeader(options, header);
+  }
 
-    if constexpr ((POS + 1) < sizeof...(TYPES))
-      this->_copyToTuple<POS + 1>(tuple, strValues);
+  /// RESOLVE HEADER
+  inline CSVOptions resolveHeader(const CSVOptions& options, const CSVHeader& header) {
+    if (!options.names.empty() && !options.header)
+      throw std::invalid_argument("Invalid CSV options: columns named without a header row");
+    if (!options.names.empty() && options.selection)
+      throw std::invalid_argument("Invalid CSV options: columns both named and selected");
+
+    CSVOptions resolved{ options };
+    if (!options.names.empty())
+      resolved.selection = header.select(options.names);
+    return resolved;
   }
 
-  /// CONSTRUCTOR 
-  template<class... TYPES>
-  CSVFileReader<TYPES...>::CSVFileReader(const std::string& fileName, char separator) {
-    // Open file
-    std::ifstream file(fileName, std::ios::in);
-    if (!file.is_open())
-      throw std::runtime_error("File cannot be opened: " + fileName);
+  /// CHECK HEADER SIZE
+  inline void checkHeaderSize(const CSVHeader& header, size_t numValues) {
+    if (!header.empty() && numValues && header.size() != numValues)
+      throw std::range_error(std::string("Inconsistent CSV header. It contains ") + std::to_string(header.size()) + " names. Expected " + std::to_string(numValues));
+  }
 
-    // Resize the vector for records
-    _records.reserve(100);
+  /// Private method _parse
+  template<class... TYPES>
+  size_t CSVFileReader<TYPES...>::_parse(SIMDTokenizer& tokenizer, std::string_view text, const CSVOptions& options, size_t& numValues, std::vector<std::tuple<TYPES...>>& records, size_t base, std::pmr::memory_resource* arena) {
+    const CSVSelection* selection{ options.selection ? &*options.selection : nullptr };
+    const size_t* columns{ selection ? selection->data() : nullptr };
+    size_t read{ 0 };
 
     // Read each line, discarding empty ones or starting with '#' or '!'
-    std::string line{ "" };
-    std::vector<std::string> strValues(sizeof...(TYPES));
+    tokenizer(text, options.separator, [&](const Tokens& tokens) {
+      std::string_view line{ tokens.line() };
+      if (line.length() == 0 || line[0] == '#' || line[0] == '!') return;
 
+      // For the first record
+      if (!numValues)
+        numValues = tokens.size();
+
+      size_t row{ base + read++ };
+      checkRecordSize(tokens, selection, numValues, row);
 
-    Tokenizer tokenizer;
-    while (!file.eof()) {
-      getline(file, line);
+      // Rejected records are discarded before converting any value
+      if (options.filter && !options.filter(tokens)) return;
 
-      if (line.length() == 0 || line[0] == '#' || line[0] == '!') continue;
+      // The record is converted in place. Moving the empty record keeps the arena of its strings
+      copyToTuple(records.emplace_back(makeRecord<TYPES...>(arena)), tokens, row, columns);
+    });
+    return read;
+  }
 
-      tokenizer(strValues, line, separator);
+  /// Private method _numValues
+  template<class... TYPES>
+  size_t CSVFileReader<TYPES...>::_numValues(const CSVOptions& options, const CSVHeader& header) {
+    // Without a selection, every record must contain one value per template parameter. With a header, as many as names
+    size_t numValues{ options.selection ? header.size() : sizeof...(TYPES) };
+    checkHeaderSize(header, numValues);
+    return numValues;
+  }
+
+  /// Private method _load
+  template<class... TYPES>
+  void CSVFileReader<TYPES...>::_load(const std::string& fileName, const CSVOptions& requested) {
+    // The cache is only valid for the same source file, value types, separator, header and selection or names.
+    // It is read before opening the source, so a valid cache never decompresses it. The header is stored in the cache
+    CacheKey key;
+    bool useCache{ false };
+    if constexpr (!uses_arena<TYPES...>::value) {
+      if (!requested.cache.empty() && !requested.filter) {
+        std::string schema{ typeSignature<TYPES...>() + requested.separator };
+        if (requested.header)
+          schema += " h";
+        if (requested.selection)
+          for (size_t i = 0; i < requested.selection->size(); ++i)
+            schema += ' ' + std::to_string((*requested.selection)[i]);
+        for (const auto& name : requested.names)
+          schema += " n" + std::to_string(name.size()) + ':' + name;
+        useCache = cacheKey(fileName, std::move(schema), key);
 
-      if (strValues.size() != sizeof...(TYPES)) {
-        file.close();
-        auto line{ _records.size() + 1 };
-        _records.clear();
-        throw std::range_error(std::string("Inconsistent CSV file. Line ") + std::to_string(line) + " contains " + std::to_string(strValues.size()) + " values. Expected " + std::to_string(sizeof...(TYPES)));
+        std::vector<std::string> names;
+        if (useCache && readCache(requested.cache, key, _records, &names)) {
+          CSVHeader header(std::move(names));
+          const CSVOptions options{ resolveHeader(requested, header) };
+          _header = options.selection ? header.subset(*options.selection) : header;
+          return;
+        }
       }
+    }
 
-      std::tuple<TYPES...> rec;
-      _copyToTuple(rec, strValues);
-        
-      _records.push_back(rec);
+    // The named columns are resolved into a selection before reading any record. A stream is opened only once, so it may be a pipe:
+    // its header is read from the first lines, in the same pass as the records
+    std::unique_ptr<FileBuffer> buffer;
+    if (requested.input == CSVInput::MAPPED)
+      buffer = std::make_unique<FileBuffer>(fileName);
+    CSVHeader header;
+    size_t start{ 0 };
+    if (buffer && requested.header)
+      start = readHeader(buffer->view(), requested.separator, header);
+    CSVOptions options{ requested };
+    size_t numValues{ 0 };
+    bool pendingHeader{ requested.header && !buffer };
+    auto resolve = [&]() {
+      options = resolveHeader(requested, header);
+      _header = options.selection ? header.subset(*options.selection) : header;
+      numValues = _numValues(options, header);
+      pendingHeader = false;
+    };
+    if (!pendingHeader)
+      resolve();
+
+    // Count the lines of mapped files, so the records are allocated at once. With a filter, most of that memory could be wasted
+    bool prescan{ options.prescan && !options.filter && options.input == CSVInput::MAPPED };
+    if (!prescan)
+      _records.reserve(100);
+
+    // Each call may run on its own thread, so each one allocates its strings in its own arena
+    auto parse = [this, &numValues, &options](SIMDTokenizer& tokenizer, std::string_view text, std::vector<std::tuple<TYPES...>>& records, size_t base) {
+      return _parse(tokenizer, text, options, numValues, records, base, uses_arena<TYPES...>::value ? _arenas.create() : nullptr);
+    };
+
+    if (options.input == CSVInput::MAPPED) {
+      std::string_view text{ buffer->view().substr(start) };
+      // All the threads must check the records against the same size
+      if (!numValues)
+        numValues = firstRecordSize(text, options.separator);
+      parseParallel(text, options.threads, _records, parse, prescan ? 1 : 0);
+    }
+    else if (options.input == CSVInput::ASYNC) {
+      SIMDTokenizer tokenizer;
+      std::pmr::memory_resource* arena{ uses_arena<TYPES...>::value ? _arenas.create() : nullptr };
+      size_t read{ 0 };
+      readBlocks(fileName, options.separator, options.bufferSize, options.queueDepth, [&](std::string_view text) {
+        if (pendingHeader) {
+          // Empty and commented lines give an empty header, and are discarded
+          text.remove_prefix(readHeader(text, options.separator, header));
+          if (header.empty())
+            return;
+          resolve();
+        }
+        read += _parse(tokenizer, text, options, numValues, _records, read, arena);
+      });
     }
+    else {
+      SIMDTokenizer tokenizer;
+      std::pmr::memory_resource* arena{ uses_arena<TYPES...>::value ? _arenas.create() : nullptr };
+      size_t read{ 0 };
+      readLines(fileName, options.separator, [&](std::string_view line) {
+        if (pendingHeader) {
+          readHeader(line, options.separator, header);
+          if (!header.empty())
+            resolve();
+          return;
+        }
+        read += _parse(tokenizer, line, options, numValues, _records, read, arena);
+      });
+    }
+
+    // Without any header row, the names cannot be resolved
+    if (pendingHeader)
+      resolve();
 
-    file.close();
+    if (!prescan)
+      _records.shrink_to_fit();
 
-    _records.shrink_to_fit();
+    // A cache which cannot be written only makes the next load slower
+    if constexpr (!uses_arena<TYPES...>::value)
+      if (useCache)
+        writeCache(options.cache, key, _records, header.names());
   }
 
+  /// Private method _checkOptions
+  template<class... TYPES>
+  void CSVFileReader<TYPES...>::_checkOptions(const CSVOptions& options) {
+    if (options.selection && options.selection->size() != sizeof...(TYPES))
+      throw std::invalid_argument("Invalid CSV selection: " + std::to_string(options.selection->size()) + " columns selected. Expected " + std::to_string(sizeof...(TYPES)));
+    if (!options.names.empty() && options.names.size() != sizeof...(TYPES))
+      throw std::invalid_argument("Invalid CSV schema: " + std::to_string(options.names.size()) + " columns named. Expected " + std::to_string(sizeof...(TYPES)));
+  }
+
+  /// CONSTRUCTOR WITH OPTIONS
+  template<class... TYPES>
+  CSVFileReader<TYPES...>::CSVFileReader(const std::string& fileName, const CSVOptions& options) {
+    _checkOptions(options);
+    _load(fileName, options);
+  }
 
 
-  /// CONSTRUCTOR SPECIALIZED CLASS
+
+  /// Private method _parse (SPECIALIZED CLASS)
   template<class TYPE>
-  CSVFileReader<TYPE>::CSVFileReader(const std::string& fileName, char separator, size_t numValues) {
-    // Open file
-    std::ifstream file(fileName, std::ios::in);
-    if (!file.is_open())
-      throw std::runtime_error("File cannot be opened: " + fileName);
+  size_t CSVFileReader<TYPE>::_parse(SIMDTokenizer& tokenizer, std::string_view text, const CSVOptions& options, size_t& numValues, std::vector<Record>& records, size_t base, std::pmr::memory_resource* arena) {
+    const CSVSelection* selection{ options.selection ? &*options.selection : nullptr };
+    size_t read{ 0 };
 
-    // Resize the vector for records
-    _records.reserve(100);
+    auto newRecord = [&records, arena](size_t size) -> Record& {
+      if constexpr (uses_arena<TYPE>::value)
+        return records.emplace_back(size, std::pmr::polymorphic_allocator<TYPE>(arena));
+      else {
+        (void)arena;
+        return records.emplace_back(size);
+      }
+    };
 
     // Read each line, discarding empty ones or starting with '#' or '!'
-    std::string line{ "" };
-    std::vector<std::string> values(numValues || 1);
-    Tokenizer tokenizer;
-    while (!file.eof()) {
-      getline(file, line);
+    tokenizer(text, options.separator, [&](const Tokens& tokens) {
+      std::string_view line{ tokens.line() };
+      if (line.length() == 0 || line[0] == '#' || line[0] == '!') return;
+
+      // For the first record
+      if (!numValues)
+        numValues = tokens.size();
 
-      if (line.length() == 0 || line[0] == '#' || line[0] == '!') continue;
+      size_t row{ base + read++ };
+      checkRecordSize(tokens, selection, numValues, row);
 
-      tokenizer(values, line, separator);
+      // Rejected records are discarded before converting any value
+      if (options.filter && !options.filter(tokens)) return;
 
-      // For the first record
-      if (!_records.size() && !numValues)
-        numValues = values.size();
-
-      if (values.size() != numValues) {
-        file.close();
-        auto line{ _records.size() + 1 };
-        _records.clear();
-        throw std::range_error(std::string("Inconsistent CSV file. Line ") + std::to_string(line) + " contains " + std::to_string(values.size()) + " values. Expected " + std::to_string(numValues));
+      if (selection) {
+        auto& values{ newRecord(selection->size()) };
+        for (size_t i = 0; i < selection->size(); ++i)
+          convertField(tokens[(*selection)[i]], values[i], row, (*selection)[i]);
+      }
+      else {
+        auto& values{ newRecord(numValues) };
+        for (size_t i = 0; i < numValues; ++i)
+          convertField(tokens[i], values[i], row, i);
       }
-      
-      _records.push_back(values);
+    });
+    return read;
+  }
+
+  /// Private method _numValues (SPECIALIZED CLASS)
+  template<class TYPE>
+  size_t CSVFileReader<TYPE>::_numValues(const CSVOptions& options, const CSVHeader& header) {
+    // With a header, every record must contain as many values as names
+    size_t numValues{ options.selection ? header.size() : options.cols };
+    checkHeaderSize(header, numValues);
+    return numValues ? numValues : header.size();
+  }
+
+  /// Private method _load (SPECIALIZED CLASS)
+  template<class TYPE>
+  void CSVFileReader<TYPE>::_load(const std::string& fileName, const CSVOptions& requested) {
+    // The named columns are resolved into a selection before reading any record. A stream is opened only once, so it may be a pipe:
+    // its header is read from the first lines, in the same pass as the records
+    std::unique_ptr<FileBuffer> buffer;
+    if (requested.input == CSVInput::MAPPED)
+      buffer = std::make_unique<FileBuffer>(fileName);
+    CSVHeader header;
+    size_t start{ 0 };
+    if (buffer && requested.header)
+      start = readHeader(buffer->view(), requested.separator, header);
+    CSVOptions options{ requested };
+    size_t numValues{ 0 };
+    bool pendingHeader{ requested.header && !buffer };
+    auto resolve = [&]() {
+      options = resolveHeader(requested, header);
+      _header = options.selection ? header.subset(*options.selection) : header;
+      numValues = _numValues(options, header);
+      pendingHeader = false;
+    };
+    if (!pendingHeader)
+      resolve();
+
+    // Count the lines of mapped files, so the records are allocated at once. With a filter, most of that memory could be wasted
+    bool prescan{ options.prescan && !options.filter && options.input == CSVInput::MAPPED };
+    if (!prescan)
+      _records.reserve(100);
+
+    // Each call may run on its own thread, so each one allocates its strings in its own arena
+    auto parse = [this, &numValues, &options](SIMDTokenizer& tokenizer, std::string_view text, std::vector<Record>& records, size_t base) {
+      return _parse(tokenizer, text, options, numValues, records, base, uses_arena<TYPE>::value ? _arenas.create() : nullptr);
+    };
+
+    if (options.input == CSVInput::MAPPED) {
+      std::string_view text{ buffer->view().substr(start) };
+      // All the threads must check the records against the same size
+      if (!numValues)
+        numValues = firstRecordSize(text, options.separator);
+      parseParallel(text, options.threads, _records, parse, prescan ? 1 : 0);
+    }
+    else if (options.input == CSVInput::ASYNC) {
+      SIMDTokenizer tokenizer;
+      std::pmr::memory_resource* arena{ uses_arena<TYPE>::value ? _arenas.create() : nullptr };
+      size_t read{ 0 };
+      readBlocks(fileName, options.separator, options.bufferSize, options.queueDepth, [&](std::string_view text) {
+        if (pendingHeader) {
+          // Empty and commented lines give an empty header, and are discarded
+          text.remove_prefix(readHeader(text, options.separator, header));
+          if (header.empty())
+            return;
+          resolve();
+        }
+        read += _parse(tokenizer, text, options, numValues, _records, read, arena);
+      });
+    }
+    else {
+      SIMDTokenizer tokenizer;
+      std::pmr::memory_resource* arena{ uses_arena<TYPE>::value ? _arenas.create() : nullptr };
+      size_t read{ 0 };
+      readLines(fileName, options.separator, [&](std::string_view line) {
+        if (pendingHeader) {
+          readHeader(line, options.separator, header);
+          if (!header.empty())
+            resolve();
+          return;
+        }
+        read += _parse(tokenizer, line, options, numValues, _records, read, arena);
+      });
     }
 
-    file.close();
+    // Without any header row, the names cannot be resolved
+    if (pendingHeader)
+      resolve();
 
-    _records.shrink_to_fit();
+    if (!prescan)
+      _records.shrink_to_fit();
+  }
+
+
+  /// Private method _index (STRING_VIEW SPECIALIZATION)
+  inline size_t CSVFileReader<std::string_view>::_index(SIMDTokenizer& tokenizer, std::string_view text, char separator, std::vector<size_t>& offsets, size_t base) const {
+    const char* data{ _buffer->data() };
+    size_t first{ offsets.size() };
+
+    // Index each line, discarding empty ones or starting with '#' or '!'
+    tokenizer(text, separator, [&](const Tokens& tokens) {
+      std::string_view line{ tokens.line() };
+      if (line.length() == 0 || line[0] == '#' || line[0] == '!') return;
+
+      if (tokens.size() != _cols) {
+        auto line{ base + (offsets.size() - first) / (_cols + 1) + 1 };
+        throw std::range_error(std::string("Inconsistent CSV file. Line ") + std::to_string(line) + " contains " + std::to_string(tokens.size()) + " values. Expected " + std::to_string(_cols));
+      }
+
+      size_t start{ size_t(line.data() - data) };
+      offsets.push_back(start);
+      for (size_t sep : tokens.separators())
+        offsets.push_back(start + sep + 1);
+      // The last value ends where the line ends
+      offsets.push_back(start + line.size() + 1);
+    });
+    return (offsets.size() - first) / (_cols + 1);
+  }
+
+  /// CONSTRUCTOR STRING_VIEW SPECIALIZATION
+  inline CSVFileReader<std::string_view>::CSVFileReader(const std::string& fileName, char separator, size_t numValues, size_t threads) : _buffer{ std::make_shared<FileBuffer>(fileName) } {
+    _cols = numValues ? numValues : firstRecordSize(_buffer->view(), separator);
+
+    // The lines are counted first, so the offsets are allocated at once
+    parseParallel(_buffer->view(), threads, _offsets, [this, separator](SIMDTokenizer& tokenizer, std::string_view text, std::vector<size_t>& offsets, size_t base) {
+      return _index(tokenizer, text, separator, offsets, base);
+    }, _cols + 1);
   }
 
 
   /// TOKENIZER FUNCTOR ******************************************************
-  void Tokenizer::operator() (std::vector<std::string>& tokens, const std::string& str, const char sep) {
+  inline void Tokenizer::operator() (std::vector<std::string>& tokens, std::string_view str, const char sep) {
     size_t init_pos{ 0 };
     size_t pos{ 0 };
-    tokens.clear();
-    while ((pos = str.find(sep, init_pos)) != std::string::npos) {
-      tokens.push_back(str.substr(init_pos, pos - init_pos));
-      init_pos = pos + 1;
+    size_t count{ 0 };
+    // Reuse the strings of the previous call, so their memory is not allocated again
+    auto add = [&tokens, &count](std::string_view token) {
+      if (count < tokens.size())
+        tokens[count].assign(token);
+      else
+        tokens.emplace_back(token);
+      ++count;
+    };
+    if (str.find('"') == std::string_view::npos) {
+      while ((pos = str.find(sep, init_pos)) != std::string_view::npos) {
+        add(str.substr(init_pos, pos - init_pos));
+        init_pos = pos + 1;
+      }
+      // Add last token
+      add(str.substr(init_pos, str.size() - init_pos));
+    }
+    else {
+      // Quoted values may contain separators, and two quotes inside them are an escaped quote
+      std::string value;
+      bool quoted{ false };
+      for (pos = 0; pos < str.size(); ++pos) {
+        if (quoted) {
+          if (str[pos] != '"') value += str[pos];
+          else if (pos + 1 < str.size() && str[pos + 1] == '"') value += str[++pos];
+          else quoted = false;
+        }
+        else if (str[pos] == sep) {
+          add(value);
+          value.clear();
+          init_pos = pos + 1;
+        }
+        else if (str[pos] == '"' && pos == init_pos)
+          quoted = true;
+        else
+          value += str[pos];
+      }
+      // Add last token
+      add(value);
     }
-    // Add last token
-    tokens.push_back(str.substr(init_pos, str.size() - init_pos));
-    tokens.shrink_to_fit();
+    tokens.resize(count);
   }
 }
 
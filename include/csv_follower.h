@@ -0,0 +1,425 @@
+//  MIT License
+//
+//  Copyright (c) 2018 Francisco de Lanuza
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+
+#ifndef CSV_FOLLOWER_H
+#define CSV_FOLLOWER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <tuple>
+#include <fstream>
+#include <stdexcept>
+#include <filesystem>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#include "csv_file_reader.h"
+
+
+namespace utils
+{
+  /**
+    *  \brief Follows a CSV file which another process keeps appending to, like 'tail -F'. The field types are provided as template parameters.
+    *         Each poll parses only the complete records appended since the previous one, and appends them to the records read so far.
+    *         A trailing incomplete line is kept until the rest of it is written.
+    *         If the file is truncated or rotated (replaced by a new file with the same name), it is read again from the start.
+    *         On Linux, wait() is woken up by inotify as soon as the file changes. Elsewhere, or if inotify is not available, the file is polled.
+    *         Commented lines (starting with '#' or '!') are discarded.
+    *         Only ASCII characters are supported!
+    */
+  template<class... TYPES>
+  class CSVFollower
+  {
+  protected:
+    /**
+      *  Name of the csv file
+      */
+    std::string _fileName;
+
+    /**
+      *  Character used as value separator
+      */
+    char _separator;
+
+    /**
+      *  Interval between two polls of the file while waiting
+      */
+    std::chrono::milliseconds _interval;
+
+    /**
+      *  Records read so far
+      */
+    std::vector<std::tuple<TYPES...>> _records;
+
+    /**
+      *  Number of records read since the file was opened, including the cleared ones. Used in error messages
+      */
+    size_t _count{ 0 };
+
+    /**
+      *  Position of the file read so far
+      */
+    uint64_t _offset{ 0 };
+
+    /**
+      *  Identity (device and inode) of the file being read, to detect its rotation. Always 0 on Windows
+      */
+    uint64_t _device{ 0 };
+    uint64_t _inode{ 0 };
+
+    /**
+      *  Data read after the last complete record
+      */
+    std::string _pending;
+
+    /**
+      *  The data read starts in the middle of a line, which must be discarded
+      */
+    bool _partial{ false };
+
+    /**
+      *  Tokenizer, reused for all the polls
+      */
+    SIMDTokenizer _tokenizer;
+
+    /**
+      *  inotify instance watching the directory of the file, or -1
+      */
+    int _inotify{ -1 };
+
+    /**
+      *  \brief Reads the data appended to the file since the last call
+      *  @param skip [in] Moves to the end of the file, without reading its content
+      *  @return  false if the file does not exist
+      */
+    bool _read(bool skip = false);
+
+    /**
+      *  \brief Parses the complete records in _pending and removes them from it
+      *  @return  the number of records parsed
+      *  @throw range_error Some record does not contain the same number of values. The next poll goes on after that record
+      *  @throw runtime_error Some value cannot be converted to its type. The next poll goes on after that record
+      */
+    size_t _parse();
+
+  public:
+    /**
+      *  \brief Constructor
+      *         Reads the current content of the file, unless fromEnd is set
+      *  @param fileName [in] Name of the csv file
+      *  @param separator [in] Character used as value separator. By default is a ','
+      *  @param fromEnd [in] Skip the current content of the file, and only read the records appended from now on
+      *  @param interval [in] Interval between two polls of the file while waiting. With inotify, it is only a safety net
+      *  @throw runtime_error File cannot be opened or some record of the current content is not valid
+      */
+    CSVFollower(const std::string& fileName, char separator = ',', bool fromEnd = false, std::chrono::milliseconds interval = std::chrono::milliseconds(100));
+
+    CSVFollower(const CSVFollower&) = delete;
+    CSVFollower& operator=(const CSVFollower&) = delete;
+
+    ~CSVFollower();
+
+    /**
+      *  \brief Reads the complete records appended to the file since the last poll, without waiting
+      *  @return  the number of records appended to the records
+      *  @throw range_error Some record does not contain the expected number of values
+      *  @throw runtime_error Some value cannot be converted to its type
+      */
+    size_t poll();
+
+    /**
+      *  \brief Waits until some complete record is appended to the file, or the timeout expires
+      *  @param timeout [in] Maximum time to wait
+      *  @return  the number of records appended to the records. '0' if the timeout has expired
+      *  @throw range_error Some record does not contain the expected number of values
+      *  @throw runtime_error Some value cannot be converted to its type
+      */
+    size_t wait(std::chrono::milliseconds timeout);
+
+    /**
+      *  \brief Indicates whether wait() is woken up by inotify, instead of polling the file
+      *  @return  true if the file is watched with inotify
+      */
+    bool watching() const { return _inotify >= 0; }
+
+    /**
+      *  \brief Returns the position of the file read so far. It goes back to 0 when the file is truncated or rotated
+      *  @return  the offset in bytes
+      */
+    uint64_t offset() const { return _offset; }
+
+    /**
+      *  \brief Releases the records read so far. The next polls go on from the same position of the file
+      */
+    void clear() { _records.clear(); }
+
+    /**
+      *  \brief Returns the number of records read and not cleared
+      *  @return  the number of records
+      */
+    size_t size() const { return _records.size(); }
+
+    /**
+      *  \brief Returns the total number of values in a record
+      *  @return  the number of values
+      */
+    constexpr size_t cols() const { return sizeof...(TYPES); }
+
+    /**
+     *  \brief Returns an iterator to the first record
+     *  @return  vector iterator
+     */
+    auto begin() const { return _records.begin(); }
+
+    /**
+     *  \brief Returns an iterator past the last record
+     *  @return  vector iterator
+     */
+    auto end() const { return _records.end(); }
+
+    /**
+    *  \brief Returns a tuple with all the values in the specified record number
+    *  @param row [in] record number, staring at 0, since the last clear()
+    *  @return  a tuple
+    */
+    const auto& operator[](size_t row) const { return _records[row]; }
+  };
+
+
+  //*** DEFINITIONS ***********************************************************************************************************/
+  //***************************************************************************************************************************/
+
+  /// CONSTRUCTOR
+  template<class... TYPES>
+  CSVFollower<TYPES...>::CSVFollower(const std::string& fileName, char separator, bool fromEnd, std::chrono::milliseconds interval)
+    : _fileName{ fileName }, _separator{ separator }, _interval{ interval } {
+    if (!_read(fromEnd))
+      throw std::runtime_error("File cannot be opened: " + fileName);
+
+#ifdef __linux__
+    // The directory is watched, instead of the file, so the watch survives the rotation of the file
+    _inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotify >= 0) {
+      std::filesystem::path directory{ std::filesystem::path(fileName).parent_path() };
+      if (directory.empty()) directory = ".";
+      if (inotify_add_watch(_inotify, directory.c_str(), IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB) < 0) {
+        ::close(_inotify);
+        _inotify = -1;
+      }
+    }
+#endif
+
+    if (!fromEnd)
+      _parse();
+  }
+
+  /// DESTRUCTOR
+  template<class... TYPES>
+  CSVFollower<TYPES...>::~CSVFollower() {
+#ifndef _WIN32
+    if (_inotify >= 0)
+      ::close(_inotify);
+#endif
+  }
+
+  /// Private method _read
+  template<class... TYPES>
+  bool CSVFollower<TYPES...>::_read(bool skip) {
+#ifdef _WIN32
+    std::error_code error;
+    uint64_t size{ uint64_t(std::filesystem::file_size(_fileName, error)) };
+    if (error)
+      return false;
+    // Without the identity of the file, a rotation is only detected if the new file is smaller
+    if (size < _offset) {
+      _offset = 0;
+      _pending.clear();
+      _partial = false;
+    }
+    if (size == _offset)
+      return true;
+
+    std::ifstream file(_fileName, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+      return false;
+    if (skip) {
+      // If the last line is being written, the rest of it must be discarded
+      char last{ '\n' };
+      file.seekg(std::streamoff(size - 1));
+      file.get(last);
+      _partial = last != '\n';
+      _offset = size;
+      return true;
+    }
+    file.seekg(std::streamoff(_offset));
+    size_t used{ _pending.size() };
+    _pending.resize(used + size_t(size - _offset));
+    file.read(_pending.data() + used, std::streamsize(size - _offset));
+    _pending.resize(used + size_t(file.gcount()));
+    _offset += uint64_t(file.gcount());
+    return true;
+#else
+    int fd{ ::open(_fileName.c_str(), O_RDONLY | O_CLOEXEC) };
+    if (fd < 0)
+      return false;
+
+    // The size and identity are taken from the opened file, so they match the data read
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      return false;
+    }
+    uint64_t size{ uint64_t(st.st_size) };
+    bool rotated{ uint64_t(st.st_dev) != _device || uint64_t(st.st_ino) != _inode };
+    if (rotated || size < _offset) {
+      _device = uint64_t(st.st_dev);
+      _inode = uint64_t(st.st_ino);
+      _offset = 0;
+      _pending.clear();
+      _partial = false;
+    }
+
+    if (skip && size) {
+      // If the last line is being written, the rest of it must be discarded
+      char last{ '\n' };
+      _partial = ::pread(fd, &last, 1, off_t(size - 1)) == 1 && last != '\n';
+      _offset = size;
+    }
+
+    while (_offset < size) {
+      size_t used{ _pending.size() };
+      _pending.resize(used + size_t(size - _offset));
+      ssize_t read{ ::pread(fd, _pending.data() + used, size_t(size - _offset), off_t(_offset)) };
+      _pending.resize(used + size_t(std::max<ssize_t>(read, 0)));
+      if (read <= 0)
+        break;
+      _offset += uint64_t(read);
+    }
+    ::close(fd);
+    return true;
+#endif
+  }
+
+  /// Private method _parse
+  template<class... TYPES>
+  size_t CSVFollower<TYPES...>::_parse() {
+    if (_partial) {
+      size_t eol{ _pending.find('\n') };
+      _pending.erase(0, eol == std::string::npos ? _pending.size() : eol + 1);
+      _partial = eol == std::string::npos;
+    }
+
+    // Only the complete records are parsed. Without quotes, they end at the last line break
+    std::string_view text{ _pending };
+    size_t complete{ 0 };
+    if (text.find('"') == std::string_view::npos)
+      complete = text.rfind('\n') + 1;
+    else {
+      RecordScanner scanner(_separator);
+      for (size_t end = scanner.scan(text); end != std::string_view::npos; end = scanner.scan(text.substr(complete)))
+        complete += end + 1;
+    }
+    if (!complete)
+      return 0;
+
+    size_t first{ _records.size() };
+    size_t added{ 0 };
+    size_t next{ 0 };
+    try {
+      // Read each line, discarding empty ones or starting with '#' or '!'
+      _tokenizer(text.substr(0, complete), _separator, [&](const Tokens& tokens) {
+        std::string_view line{ tokens.line() };
+        // An invalid record is discarded, so the next poll goes on after it
+        next = std::min(text.find('\n', size_t(line.data() - text.data()) + line.size()), complete - 1) + 1;
+        if (line.length() == 0 || line[0] == '#' || line[0] == '!') return;
+
+        size_t row{ _count++ };
+        checkRecordSize(tokens, nullptr, sizeof...(TYPES), row);
+        copyToTuple(_records.emplace_back(), tokens, row);
+        ++added;
+      });
+    }
+    catch (...) {
+      // The record being converted is incomplete
+      _records.erase(_records.begin() + std::ptrdiff_t(first + added), _records.end());
+      _pending.erase(0, next);
+      throw;
+    }
+    _pending.erase(0, complete);
+    return added;
+  }
+
+  /// POLL
+  template<class... TYPES>
+  size_t CSVFollower<TYPES...>::poll() {
+    // A file being rotated may not exist for a while
+    if (!_read())
+      return 0;
+    return _parse();
+  }
+
+  /// WAIT
+  template<class... TYPES>
+  size_t CSVFollower<TYPES...>::wait(std::chrono::milliseconds timeout) {
+    auto deadline{ std::chrono::steady_clock::now() + timeout };
+    while (true) {
+      size_t added{ poll() };
+      if (added)
+        return added;
+
+      auto now{ std::chrono::steady_clock::now() };
+      if (now >= deadline)
+        return 0;
+      auto remaining{ std::min(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now), _interval) };
+
+#ifdef __linux__
+      if (_inotify >= 0) {
+        // Any change in the directory wakes up the wait. The file is polled anyway after the interval, in case some event is lost
+        pollfd fd{ _inotify, POLLIN, 0 };
+        if (::poll(&fd, 1, int(remaining.count()) + 1) > 0) {
+          char events[4096];
+          while (::read(_inotify, events, sizeof(events)) > 0) {}
+        }
+        continue;
+      }
+#endif
+      std::this_thread::sleep_for(remaining);
+    }
+  }
+}
+
+#endif // CSV_FOLLOWER_H
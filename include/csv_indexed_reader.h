@@ -0,0 +1,448 @@
+//  MIT License
+//
+//  Copyright (c) 2018 Francisco de Lanuza
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+
+#ifndef CSV_INDEXED_READER_H
+#define CSV_INDEXED_READER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <tuple>
+#include <memory>
+#include <fstream>
+#include <stdexcept>
+#include <filesystem>
+#include <system_error>
+#include <cstdint>
+#include <cstring>
+
+#include "csv_file_reader.h"
+
+
+namespace utils
+{
+  /**
+    *  \brief Finds the next record of a text, discarding empty and commented lines. Records with quoted values may span several lines
+    *  @param text [in] Text to be searched
+    *  @param pos [in] Position where the search starts, at the start of a line
+    *  @param separator [in] Character used as value separator
+    *  @param start [out] Position of the first character of the record
+    *  @return  the position of the line break ending the record (the size of the text for the last one), or npos if there are no more records
+    */
+  size_t nextRecord(std::string_view text, size_t pos, char separator, size_t& start);
+
+
+  /**
+    *  \brief Offsets of the records of a CSV text: one uint64_t per record or, if sampled, per step records.
+    *         The index is built lazily, only as far as the records accessed so far. It can be saved to a file, which is memory-mapped
+    *         when loaded, so reopening the index of a huge file does not scan the file nor read the whole index.
+    */
+  class CSVRowIndex
+  {
+  protected:
+    /**
+      *  Offsets of the records 0, step, 2 * step... indexed so far
+      */
+    std::vector<uint64_t> _offsets;
+
+    /**
+      *  Saved index, if it has been loaded. Its offsets are read from the mapped file instead of _offsets
+      */
+    std::unique_ptr<FileBuffer> _file;
+    const char* _saved{ nullptr };
+
+    /**
+      *  Number of records between two offsets
+      */
+    size_t _step;
+
+    /**
+      *  Number of records indexed so far
+      */
+    size_t _rows{ 0 };
+
+    /**
+      *  Position of the text where the indexing goes on
+      */
+    size_t _next{ 0 };
+
+    /**
+      *  All the records of the text have been indexed
+      */
+    bool _complete{ false };
+
+  public:
+    /**
+      *  \brief Constructor
+      *  @param step [in] Number of records between two stored offsets. '1' stores the offset of every record
+      */
+    explicit CSVRowIndex(size_t step = 1) : _step{ step ? step : 1 } {}
+
+    /**
+      *  \brief Returns the number of records between two stored offsets
+      *  @return  the step
+      */
+    size_t step() const { return _step; }
+
+    /**
+      *  \brief Returns the number of records indexed so far
+      *  @return  the number of records
+      */
+    size_t rows() const { return _rows; }
+
+    /**
+      *  \brief Indicates whether all the records have been indexed
+      *  @return  true if the index is complete
+      */
+    bool complete() const { return _complete; }
+
+    /**
+      *  \brief Returns the number of stored offsets
+      *  @return  the number of offsets
+      */
+    size_t samples() const { return _saved ? (_rows + _step - 1) / _step : _offsets.size(); }
+
+    /**
+      *  \brief Returns a stored offset
+      *  @param sample [in] Offset number. It is the offset of the record sample * step
+      *  @return  the offset in the text
+      */
+    uint64_t sample(size_t sample) const;
+
+    /**
+      *  \brief Indexes the records of the text, until the given record or the end of the text
+      *  @param text [in] Text being indexed. Must be the same on every call
+      *  @param separator [in] Character used as value separator
+      *  @param row [in] Record number, starting at 0. npos indexes the whole text
+      *  @return  false if the text contains fewer records
+      */
+    bool extend(std::string_view text, char separator, size_t row = std::string_view::npos);
+
+    /**
+      *  \brief Finds a record already indexed, skipping the records following the closest stored offset
+      *  @param text [in] Text which has been indexed
+      *  @param separator [in] Character used as value separator
+      *  @param row [in] Record number, starting at 0. Must be lower than rows()
+      *  @return  the record, without the line break
+      */
+    std::string_view record(std::string_view text, char separator, size_t row) const;
+
+    /**
+      *  \brief Saves the complete index to a file, with writeAtomically
+      *  @param indexName [in] Name of the index file
+      *  @param key [in] Key of the indexed file
+      *  @return  false if the index is not complete or cannot be written
+      */
+    bool save(const std::string& indexName, const CacheKey& key) const;
+
+    /**
+      *  \brief Loads an index saved for the same file. The index file is memory-mapped and kept open
+      *  @param indexName [in] Name of the index file
+      *  @param key [in] Key of the indexed file. The index is discarded if its key does not match
+      *  @return  false if the index does not exist, cannot be read, is stale or is not valid. The index is not modified in that case
+      */
+    bool load(const std::string& indexName, const CacheKey& key);
+  };
+
+
+  /**
+    *  \brief Random access CSV file reader. The field types are provided as template parameters.
+    *         The file is memory-mapped, and only the offsets of its records are indexed. Each record is parsed on demand,
+    *         so accessing a few records of a huge file does not load it. The index can be saved, so that reopening the file
+    *         gives access to any record without scanning it again.
+    *         Commented lines (starting with '#' or '!') are discarded.
+    *         The index is extended by the accesses, so a reader must not be shared between threads.
+    *         Only ASCII characters are supported!
+    */
+  template<class... TYPES>
+  class CSVIndexedReader
+  {
+  protected:
+    /**
+      *  Name of the csv file
+      */
+    std::string _fileName;
+
+    /**
+      *  Content of the file
+      */
+    FileBuffer _buffer;
+
+    /**
+      *  Character used as value separator
+      */
+    char _separator;
+
+    /**
+      *  Offsets of the records
+      */
+    CSVRowIndex _index;
+
+    /**
+      *  Tokenizer, reused for all the records
+      */
+    SIMDTokenizer _tokenizer;
+
+    /**
+      *  \brief Returns the key of the index of the file
+      *  @param key [out] The key
+      *  @return  false if the size or modification time of the file cannot be read
+      */
+    bool _key(CacheKey& key) const { return cacheKey(_fileName, std::string("rows") + _separator, key); }
+
+  public:
+    /**
+      *  \brief Constructor
+      *         Maps the file into memory. The records are indexed when accessed, unless a valid index file is given
+      *  @param fileName [in] Name of the csv file
+      *  @param separator [in] Character used as value separator. By default is a ','
+      *  @param step [in] Number of records between two stored offsets. Higher values take less memory, but each access parses more lines
+      *  @param indexName [in] Index file saved by saveIndex. Ignored if it is empty, stale or not valid
+      *  @throw runtime_error File cannot be opened
+      */
+    CSVIndexedReader(const std::string& fileName, char separator = ',', size_t step = 1, const std::string& indexName = "");
+
+    CSVIndexedReader(const CSVIndexedReader&) = delete;
+    CSVIndexedReader& operator=(const CSVIndexedReader&) = delete;
+
+    /**
+      *  \brief Returns the total number of records in the csv file. The whole file is indexed
+      *  @return  the number of records
+      */
+    size_t size() { _index.extend(_buffer.view(), _separator); return _index.rows(); }
+
+    /**
+      *  \brief Returns the total number of values in a record
+      *  @return  the number of values
+      */
+    constexpr size_t cols() const { return sizeof...(TYPES); }
+
+    /**
+      *  \brief Returns the offsets of the records indexed so far
+      *  @return  the index
+      */
+    const CSVRowIndex& index() const { return _index; }
+
+    /**
+      *  \brief Returns the text of a record, without parsing it
+      *  @param row [in] record number, staring at 0
+      *  @return  a view of the record, valid while the reader is alive
+      *  @throw  out_of_range exception if there is no row with that number
+      */
+    std::string_view line(size_t row);
+
+    /**
+      *  \brief Parses a record
+      *  @param row [in] record number, staring at 0
+      *  @return  a tuple with the values of the record
+      *  @throw  out_of_range exception if there is no row with that number
+      *  @throw  range_error The record does not contain one value per template parameter
+      *  @throw  runtime_error Some value cannot be converted to its type
+      */
+    std::tuple<TYPES...> operator[](size_t row);
+
+    /**
+      *  \brief Indexes the whole file and saves the index, so the next readers of the same file can load it
+      *  @param indexName [in] Name of the index file
+      *  @return  false if the index cannot be written
+      */
+    bool saveIndex(const std::string& indexName);
+  };
+
+
+  //*** DEFINITIONS ***********************************************************************************************************/
+  //***************************************************************************************************************************/
+
+  /// Magic number and version of the index format
+  constexpr char INDEX_MAGIC[8]{ 'F', 'R', 'I', 'N', 'D', 'E', 'X', '1' };
+
+  /// NEXT RECORD
+  inline size_t nextRecord(std::string_view text, size_t pos, char separator, size_t& start) {
+    const char* data{ text.data() };
+    while (pos < text.size()) {
+      const char* eol{ static_cast<const char*>(memchr(data + pos, '\n', text.size() - pos)) };
+      size_t end{ eol ? size_t(eol - data) : text.size() };
+      // Lines with quotes are scanned, to skip the line breaks inside quoted values
+      if (memchr(data + pos, '"', end - pos)) {
+        RecordScanner scanner(separator);
+        size_t found{ scanner.scan(text.substr(pos)) };
+        end = found == std::string_view::npos ? text.size() : pos + found;
+      }
+      if (!isBlankOrComment(text.substr(pos, end - pos))) {
+        start = pos;
+        return end;
+      }
+      pos = end + 1;
+    }
+    return std::string_view::npos;
+  }
+
+  /// SAMPLE
+  inline uint64_t CSVRowIndex::sample(size_t sample) const {
+    if (!_saved)
+      return _offsets[sample];
+    // The saved offsets may not be aligned in the mapped file
+    uint64_t offset;
+    std::memcpy(&offset, _saved + sample * sizeof(uint64_t), sizeof(offset));
+    return offset;
+  }
+
+  /// EXTEND
+  inline bool CSVRowIndex::extend(std::string_view text, char separator, size_t row) {
+    while (!_complete && _rows <= row) {
+      size_t start;
+      size_t end{ nextRecord(text, _next, separator, start) };
+      if (end == std::string_view::npos) {
+        _complete = true;
+        break;
+      }
+      if (_rows % _step == 0)
+        _offsets.push_back(start);
+      ++_rows;
+      _next = end + 1;
+    }
+    return row < _rows;
+  }
+
+  /// RECORD
+  inline std::string_view CSVRowIndex::record(std::string_view text, char separator, size_t row) const {
+    size_t start{ size_t(sample(row / _step)) };
+    size_t end{ nextRecord(text, start, separator, start) };
+    for (size_t skip = row % _step; skip; --skip)
+      end = nextRecord(text, end + 1, separator, start);
+    return text.substr(start, end - start);
+  }
+
+  /// SAVE
+  inline bool CSVRowIndex::save(const std::string& indexName, const CacheKey& key) const {
+    if (!_complete)
+      return false;
+
+    return writeAtomically(indexName, [this, &key](std::ofstream& file) {
+      auto write = [&file](const auto& value) {
+        using TYPE = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same<TYPE, std::string>::value) {
+          uint64_t size{ value.size() };
+          file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+          file.write(value.data(), std::streamsize(value.size()));
+        }
+        else {
+          file.write(reinterpret_cast<const char*>(&value), sizeof(TYPE));
+        }
+      };
+
+      file.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+      write(CACHE_BYTE_ORDER);
+      write(key.path);
+      write(key.size);
+      write(key.mtime);
+      write(key.schema);
+      write(uint64_t(_step));
+      write(uint64_t(_rows));
+      if (_saved)
+        file.write(_saved, std::streamsize(samples() * sizeof(uint64_t)));
+      else
+        file.write(reinterpret_cast<const char*>(_offsets.data()), std::streamsize(_offsets.size() * sizeof(uint64_t)));
+    });
+  }
+
+  /// LOAD
+  inline bool CSVRowIndex::load(const std::string& indexName, const CacheKey& key) {
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(indexName, error))
+      return false;
+
+    // An index which cannot be read, for instance without permission, is just missing
+    std::unique_ptr<FileBuffer> file;
+    try {
+      file = std::make_unique<FileBuffer>(indexName);
+    }
+    catch (std::runtime_error&) {
+      return false;
+    }
+    CacheCursor cursor(file->view());
+
+    char magic[sizeof(INDEX_MAGIC)];
+    uint32_t byteOrder;
+    CacheKey saved;
+    uint64_t step;
+    uint64_t rows;
+    if (!cursor.read(magic, sizeof(magic)) || std::memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0 ||
+        !cursor.read(byteOrder) || byteOrder != CACHE_BYTE_ORDER ||
+        !cursor.read(saved.path) || !cursor.read(saved.size) || !cursor.read(saved.mtime) || !cursor.read(saved.schema) ||
+        !(saved == key) || !cursor.read(step) || !cursor.read(rows) || step == 0)
+      return false;
+
+    // The rest of the file must be exactly the offsets
+    size_t header{ file->size() - cursor.remaining() };
+    if (cursor.remaining() != (rows + step - 1) / step * sizeof(uint64_t))
+      return false;
+
+    _offsets.clear();
+    _saved = file->data() + header;
+    _file = std::move(file);
+    _step = size_t(step);
+    _rows = size_t(rows);
+    _next = size_t(key.size);
+    _complete = true;
+    return true;
+  }
+
+  /// CONSTRUCTOR
+  template<class... TYPES>
+  CSVIndexedReader<TYPES...>::CSVIndexedReader(const std::string& fileName, char separator, size_t step, const std::string& indexName)
+    : _fileName{ fileName }, _buffer{ fileName }, _separator{ separator }, _index{ step } {
+    CacheKey key;
+    if (!indexName.empty() && _key(key))
+      _index.load(indexName, key);
+  }
+
+  /// LINE
+  template<class... TYPES>
+  std::string_view CSVIndexedReader<TYPES...>::line(size_t row) {
+    if (!_index.extend(_buffer.view(), _separator, row))
+      throw std::out_of_range("CSV record out of range: " + std::to_string(row));
+    return _index.record(_buffer.view(), _separator, row);
+  }
+
+  /// RECORD
+  template<class... TYPES>
+  std::tuple<TYPES...> CSVIndexedReader<TYPES...>::operator[](size_t row) {
+    std::tuple<TYPES...> record;
+    _tokenizer(line(row), _separator, [&](const Tokens& tokens) {
+      checkRecordSize(tokens, nullptr, sizeof...(TYPES), row);
+      copyToTuple(record, tokens, row);
+    });
+    return record;
+  }
+
+  /// SAVE INDEX
+  template<class... TYPES>
+  bool CSVIndexedReader<TYPES...>::saveIndex(const std::string& indexName) {
+    CacheKey key;
+    _index.extend(_buffer.view(), _separator);
+    return _key(key) && _index.save(indexName, key);
+  }
+}
+
+#endif // CSV_INDEXED_READER_H
@@ -0,0 +1,440 @@
+//  MIT License
+//
+//  Copyright (c) 2018 Francisco de Lanuza
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+
+#ifndef CSV_MULTI_READER_H
+#define CSV_MULTI_READER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <algorithm>
+#include <numeric>
+#include <filesystem>
+#include <system_error>
+
+#include "csv_file_reader.h"
+
+
+namespace utils
+{
+  /**
+    *  \brief Pool of threads running a batch of tasks with work stealing.
+    *         Each thread starts with its own queue of tasks. When it is empty, the thread steals the tasks left in the queues of
+    *         the other threads, so no thread is idle while some task is waiting.
+    */
+  class WorkStealingPool
+  {
+  protected:
+    /**
+      *  Queue of task numbers of one thread
+      */
+    struct Queue
+    {
+      std::deque<size_t> tasks;
+      std::mutex mutex;
+    };
+
+    /**
+      *  Number of threads
+      */
+    size_t _threads;
+
+  public:
+    /**
+      *  \brief Constructor
+      *  @param threads [in] Number of threads. '0' means one per hardware thread
+      */
+    explicit WorkStealingPool(size_t threads = 0) : _threads{ threads ? threads : std::max(1u, std::thread::hardware_concurrency()) } {}
+
+    /**
+      *  \brief Returns the number of threads
+      *  @return  the number of threads
+      */
+    size_t threads() const { return _threads; }
+
+    /**
+      *  \brief Runs a batch of tasks, and waits until all of them have finished.
+      *         The tasks are dealt to the threads in order, so the most expensive ones should be first
+      *  @param tasks [in] Number of tasks
+      *  @param func [in] Callable object func(size_t task) running a task. It must not throw
+      */
+    template<class FUNC>
+    void run(size_t tasks, FUNC&& func) const;
+  };
+
+
+  /**
+    *  \brief Returns the files matching a pattern. The wildcards '*' (any sequence of characters) and '?' (any character)
+    *         are only supported in the file name, not in the directories
+    *  @param pattern [in] Path of the files, such as "data/2024-*.csv"
+    *  @return  the names of the matching regular files, sorted
+    */
+  std::vector<std::string> globFiles(const std::string& pattern);
+
+  /**
+    *  \brief Indicates whether a name matches a pattern with the wildcards '*' and '?'
+    *  @param pattern [in] Pattern
+    *  @param name [in] Name
+    *  @return  true if the name matches
+    */
+  bool matchWildcards(std::string_view pattern, std::string_view name);
+
+
+  /**
+    *  \brief Loads many CSV files concurrently on a work stealing pool. Big files are split in chunks of whole lines, so a few of them
+    *         do not keep a single thread busy while the rest are idle. Used through loadFiles, loadGlob and loadMerged.
+    *  @param READER [in] Reader type: CSVFileReader with one or several value types
+    */
+  template<class READER>
+  class CSVMultiLoader
+  {
+  public:
+    /**
+      *  Minimum size of the chunks the big files are split in
+      */
+    static constexpr size_t CHUNK_SIZE{ 1 << 22 };
+
+    /**
+      *  \brief Loads the files
+      *  @param fileNames [in] Names of the csv files
+      *  @param options [in] Loading options, shared by all the files. The threads option is the size of the pool.
+      *                      The files are always memory-mapped, and the cache option is ignored
+      *  @return  one reader per file, in the same order
+      *  @throw  the first error, in the order of the files
+      */
+    static std::vector<READER> load(const std::vector<std::string>& fileNames, const CSVOptions& options);
+
+    /**
+      *  \brief Merges the records of several readers, in their order, into the first one
+      *  @param readers [in/out] Readers to be merged. They are left empty
+      *  @return  a reader with all the records
+      */
+    static READER merge(std::vector<READER>& readers);
+  };
+
+
+  /**
+    *  \brief Loads many CSV files concurrently, on a pool of threads with work stealing
+    *  @param fileNames [in] Names of the csv files
+    *  @param options [in] Loading options, shared by all the files. The threads option is the size of the pool ('0' means one per
+    *                      hardware thread). Each file resolves its own named columns. The files are always memory-mapped, and the cache
+    *                      option is ignored
+    *  @return  one reader per file, in the same order
+    *  @throw  the first error, in the order of the files
+    */
+  template<class... TYPES>
+  std::vector<CSVFileReader<TYPES...>> loadFiles(const std::vector<std::string>& fileNames, const CSVOptions& options = CSVOptions(',', CSVInput::MAPPED, 0));
+
+  /**
+    *  \brief Loads concurrently all the files matching a pattern
+    *  @param pattern [in] Path of the files. The wildcards '*' and '?' are supported in the file name
+    *  @param options [in] Loading options, shared by all the files
+    *  @return  one reader per file, in the order of their names
+    *  @throw  the first error, in the order of the files
+    */
+  template<class... TYPES>
+  std::vector<CSVFileReader<TYPES...>> loadGlob(const std::string& pattern, const CSVOptions& options = CSVOptions(',', CSVInput::MAPPED, 0));
+
+  /**
+    *  \brief Loads many CSV files concurrently, into a single reader
+    *  @param fileNames [in] Names of the csv files
+    *  @param options [in] Loading options, shared by all the files
+    *  @return  a reader with the records of all the files, in the order of the files. Its header is the one of the first file
+    *  @throw  the first error, in the order of the files
+    */
+  template<class... TYPES>
+  CSVFileReader<TYPES...> loadMerged(const std::vector<std::string>& fileNames, const CSVOptions& options = CSVOptions(',', CSVInput::MAPPED, 0));
+
+
+  //*** DEFINITIONS ***********************************************************************************************************/
+  //***************************************************************************************************************************/
+
+  /// RUN
+  template<class FUNC>
+  void WorkStealingPool::run(size_t tasks, FUNC&& func) const {
+    size_t threads{ std::min(_threads, tasks) };
+    if (threads <= 1) {
+      for (size_t task = 0; task < tasks; ++task)
+        func(task);
+      return;
+    }
+
+    // Dealt in turns, so every queue starts with some of the most expensive tasks
+    std::vector<Queue> queues(threads);
+    for (size_t task = 0; task < tasks; ++task)
+      queues[task % threads].tasks.push_back(task);
+
+    auto next = [&queues, threads](size_t self, size_t& task) {
+      // Own tasks are taken from the front, in order. Stolen tasks from the back, so the owner and the thief rarely meet
+      for (size_t i = 0; i < threads; ++i) {
+        Queue& queue{ queues[(self + i) % threads] };
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) continue;
+        if (i == 0) {
+          task = queue.tasks.front();
+          queue.tasks.pop_front();
+        }
+        else {
+          task = queue.tasks.back();
+          queue.tasks.pop_back();
+        }
+        return true;
+      }
+      return false;
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    try {
+      for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([&next, &func, i]() {
+          size_t task;
+          while (next(i, task))
+            func(task);
+        });
+      }
+    }
+    catch (...) {
+      // No more threads can be created: the running ones steal the tasks of the missing ones
+      for (auto& worker : workers) worker.join();
+      if (workers.empty()) throw;
+      return;
+    }
+    for (auto& worker : workers) worker.join();
+  }
+
+  /// MATCH WILDCARDS
+  inline bool matchWildcards(std::string_view pattern, std::string_view name) {
+    size_t p{ 0 };
+    size_t n{ 0 };
+    // Position of the last '*', and of the name when it was found, to backtrack
+    size_t star{ std::string_view::npos };
+    size_t starName{ 0 };
+    while (n < name.size()) {
+      if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+        ++p;
+        ++n;
+      }
+      else if (p < pattern.size() && pattern[p] == '*') {
+        star = p++;
+        starName = n;
+      }
+      else if (star != std::string_view::npos) {
+        p = star + 1;
+        n = ++starName;
+      }
+      else
+        return false;
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+      ++p;
+    return p == pattern.size();
+  }
+
+  /// GLOB FILES
+  inline std::vector<std::string> globFiles(const std::string& pattern) {
+    std::filesystem::path path{ pattern };
+    std::filesystem::path directory{ path.parent_path() };
+    std::string name{ path.filename().string() };
+
+    std::vector<std::string> files;
+    std::error_code error;
+    for (std::filesystem::directory_iterator it(directory.empty() ? "." : directory, error), end; !error && it != end; it.increment(error)) {
+      if (it->is_regular_file(error) && matchWildcards(name, it->path().filename().string()))
+        files.push_back((directory / it->path().filename()).string());
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+  }
+
+  /// LOAD
+  template<class READER>
+  std::vector<READER> CSVMultiLoader<READER>::load(const std::vector<std::string>& fileNames, const CSVOptions& options) {
+    using Records = decltype(READER::_records);
+    READER::_checkOptions(options);
+
+    // State of each file
+    struct File
+    {
+      std::unique_ptr<FileBuffer> buffer;
+      CSVOptions options;
+      size_t numValues{ 0 };
+      std::string_view text;
+      std::vector<std::string_view> chunks;
+      size_t firstChunk{ 0 };
+      std::exception_ptr error;
+    };
+
+    WorkStealingPool pool(options.threads);
+    std::vector<READER> readers;
+    readers.reserve(fileNames.size());
+    for (size_t i = 0; i < fileNames.size(); ++i)
+      readers.push_back(READER());
+
+    // Map the files and read their headers
+    std::vector<File> files(fileNames.size());
+    pool.run(files.size(), [&](size_t i) {
+      File& file{ files[i] };
+      try {
+        file.buffer = std::make_unique<FileBuffer>(fileNames[i]);
+        CSVHeader header;
+        size_t start;
+        file.options = loadHeader(fileNames[i], file.buffer.get(), options, header, start);
+        readers[i]._header = file.options.selection ? header.subset(*file.options.selection) : header;
+
+        file.text = file.buffer->view().substr(start);
+        file.numValues = READER::_numValues(file.options, header);
+        if (!file.numValues)
+          file.numValues = firstRecordSize(file.text, file.options.separator);
+      }
+      catch (...) {
+        file.error = std::current_exception();
+      }
+    });
+
+    // Only the files bigger than the share of a thread are split, since stitching the chunks has a cost
+    size_t total{ 0 };
+    for (auto& file : files)
+      total += file.text.size();
+    size_t chunkSize{ std::max(CHUNK_SIZE, total / pool.threads() + 1) };
+    for (auto& file : files)
+      file.chunks = splitLines(file.text, file.text.size() / chunkSize + 1);
+
+    // The chunks of all the files are parsed on the pool, the biggest ones first
+    struct Chunk
+    {
+      size_t file;
+      size_t chunk;
+      Records records;
+      size_t count{ 0 };
+      std::exception_ptr error;
+    };
+    std::vector<Chunk> chunks;
+    for (size_t i = 0; i < files.size(); ++i) {
+      files[i].firstChunk = chunks.size();
+      for (size_t c = 0; c < files[i].chunks.size(); ++c)
+        chunks.push_back(Chunk{ i, c, Records(), 0, nullptr });
+    }
+    std::vector<size_t> order(chunks.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return files[chunks[a].file].chunks[chunks[a].chunk].size() > files[chunks[b].file].chunks[chunks[b].chunk].size();
+    });
+
+    pool.run(order.size(), [&](size_t task) {
+      Chunk& chunk{ chunks[order[task]] };
+      File& file{ files[chunk.file] };
+      try {
+        std::string_view text{ file.chunks[chunk.chunk] };
+        if (file.options.prescan && !file.options.filter)
+          chunk.records.reserve(SIMDTokenizer::countLines(text));
+        SIMDTokenizer tokenizer;
+        size_t numValues{ file.numValues };
+        chunk.count = READER::_parse(tokenizer, text, file.options, numValues, chunk.records, 0, READER::USES_ARENA ? readers[chunk.file]._arenas.create() : nullptr);
+      }
+      catch (...) {
+        chunk.error = std::current_exception();
+      }
+    });
+
+    // Stitch the chunks of each file in order. The first error is thrown, knowing how many records precede it
+    for (size_t i = 0; i < files.size(); ++i) {
+      File& file{ files[i] };
+      if (file.error)
+        std::rethrow_exception(file.error);
+
+      Records& records{ readers[i]._records };
+      if (file.chunks.size() > 1) {
+        size_t total{ 0 };
+        for (size_t c = 0; c < file.chunks.size(); ++c)
+          total += chunks[file.firstChunk + c].records.size();
+        records.reserve(total);
+      }
+      size_t base{ 0 };
+      for (size_t c = 0; c < file.chunks.size(); ++c) {
+        Chunk& chunk{ chunks[file.firstChunk + c] };
+        if (chunk.error) {
+          // Parsed again to number the failing row. Arena strings need an arena, which outlives the discarded records
+          SIMDTokenizer tokenizer;
+          std::pmr::monotonic_buffer_resource arena;
+          Records discarded;
+          size_t numValues{ file.numValues };
+          READER::_parse(tokenizer, file.chunks[c], file.options, numValues, discarded, base, READER::USES_ARENA ? &arena : nullptr);
+          std::rethrow_exception(chunk.error);
+        }
+        if (records.empty())
+          records.swap(chunk.records);
+        else
+          appendRecords(records, chunk.records);
+        base += chunk.count;
+      }
+    }
+    return readers;
+  }
+
+  /// MERGE
+  template<class READER>
+  READER CSVMultiLoader<READER>::merge(std::vector<READER>& readers) {
+    READER merged;
+    if (readers.empty())
+      return merged;
+
+    size_t total{ 0 };
+    for (auto& reader : readers)
+      total += reader._records.size();
+    merged._records.reserve(total);
+    merged._header = readers[0]._header;
+    for (auto& reader : readers) {
+      appendRecords(merged._records, reader._records);
+      merged._arenas.share(reader._arenas);
+    }
+    return merged;
+  }
+
+  /// LOAD FILES
+  template<class... TYPES>
+  std::vector<CSVFileReader<TYPES...>> loadFiles(const std::vector<std::string>& fileNames, const CSVOptions& options) {
+    return CSVMultiLoader<CSVFileReader<TYPES...>>::load(fileNames, options);
+  }
+
+  /// LOAD GLOB
+  template<class... TYPES>
+  std::vector<CSVFileReader<TYPES...>> loadGlob(const std::string& pattern, const CSVOptions& options) {
+    return CSVMultiLoader<CSVFileReader<TYPES...>>::load(globFiles(pattern), options);
+  }
+
+  /// LOAD MERGED
+  template<class... TYPES>
+  CSVFileReader<TYPES...> loadMerged(const std::vector<std::string>& fileNames, const CSVOptions& options) {
+    auto readers{ CSVMultiLoader<CSVFileReader<TYPES...>>::load(fileNames, options) };
+    return CSVMultiLoader<CSVFileReader<TYPES...>>::merge(readers);
+  }
+}
+
+#endif // CSV_MULTI_READER_H
@@ -0,0 +1,260 @@
+//  MIT License
+//
+//  Copyright (c) 2018 Francisco de Lanuza
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+#ifndef CSV_STREAM_H
+#define CSV_STREAM_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <tuple>
+#include <stdexcept>
+#include <iterator>
+#include <cstring>
+
+#include "csv_file_reader.h"
+
+
+namespace utils
+{
+  /**
+    *  \brief Streaming CSV reader. The field types are provided as template parameters.
+    *         The records are read one at a time through a buffer of fixed size, so the memory used does not depend on the
+    *         size of the file. The buffer only grows if a single line does not fit in it.
+    *         Compressed files (gzip or Zstandard) are decompressed on the fly.
+    *         Commented lines (starting with '#' or '!') are discarded.
+    *         Only ASCII characters are supported!
+    */
+  template<class... TYPES>
+  class CSVStream
+  {
+  public:
+    /**
+      *  \brief Input iterator through the records of the stream. All the iterators of a stream share its current record
+      */
+    class iterator
+    {
+    protected:
+      CSVStream* _stream;
+
+    public:
+      using iterator_category = std::input_iterator_tag;
+      using value_type = std::tuple<TYPES...>;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const std::tuple<TYPES...>*;
+      using reference = const std::tuple<TYPES...>&;
+
+      explicit iterator(CSVStream* stream) : _stream{ stream } {}
+      reference operator*() const { return _stream->record(); }
+      pointer operator->() const { return &_stream->record(); }
+      iterator& operator++() { if (!_stream->next()) _stream = nullptr; return *this; }
+      void operator++(int) { ++(*this); }
+      bool operator==(const iterator& other) const { return _stream == other._stream; }
+      bool operator!=(const iterator& other) const { return _stream != other._stream; }
+    };
+
+  protected:
+    /**
+      *  Source of the content of the file being read
+      */
+    BlockSource _source;
+
+    /**
+      *  The whole file has been read
+      */
+    bool _eof{ false };
+
+    /**
+      *  Character used as value separator
+      */
+    char _separator;
+
+    /**
+      *  Read buffer. The data not consumed yet is in [_begin, _end)
+      */
+    std::vector<char> _buffer;
+    size_t _begin{ 0 };
+    size_t _end{ 0 };
+
+    /**
+      *  Tokenizer, reused for all the lines
+      */
+    SIMDTokenizer _tokenizer;
+
+    /**
+      *  Finds the end of the records containing quoted values, which may span several lines
+      */
+    RecordScanner _scanner;
+
+    /**
+      *  Current record
+      */
+    std::tuple<TYPES...> _record;
+
+    /**
+      *  Number of records read so far
+      */
+    size_t _count{ 0 };
+
+    /**
+      *  \brief Returns the next line in the buffer, reading more data from the file when needed.
+      *         Line breaks inside quoted values do not end the line
+      *  @param line [out] the line, without the line break
+      *  @return  false if the end of the file has been reached
+      */
+    bool _nextLine(std::string_view& line);
+
+  public:
+    /**
+      *  \brief Constructor
+      *         Opens the file. No record is read until begin() or next() are called
+      *  @param fileName [in] Name of the csv file
+      *  @param separator [in] Character used as value separator. By default is a ','
+      *  @param bufferSize [in] Size of the read buffer in bytes
+      *  @throw runtime_error File cannot be opened, or it is compressed in a format not compiled in
+      */
+    CSVStream(const std::string& fileName, char separator = ',', size_t bufferSize = 1 << 16);
+
+    CSVStream(const CSVStream&) = delete;
+    CSVStream& operator=(const CSVStream&) = delete;
+
+    /**
+      *  \brief Reads the next record
+      *  @return  false if there are no more records
+      *  @throw range_error The record does not contain the expected number of values
+      */
+    bool next();
+
+    /**
+      *  \brief Returns the current record
+      *  @return  a tuple with the values of the last record read
+      */
+    const std::tuple<TYPES...>& record() const { return _record; }
+
+    /**
+      *  \brief Returns the number of records read so far
+      *  @return  the number of records
+      */
+    size_t count() const { return _count; }
+
+    /**
+      *  \brief Returns the total number of values in a record
+      *  @return  the number of values
+      */
+    constexpr size_t cols() const { return sizeof...(TYPES); }
+
+    /**
+      *  \brief Reads the next record and returns an iterator to it
+      *  @return  input iterator
+      */
+    iterator begin() { return iterator(next() ? this : nullptr); }
+
+    /**
+      *  \brief Returns the iterator reached after the last record
+      *  @return  input iterator
+      */
+    iterator end() { return iterator(nullptr); }
+  };
+
+
+  //*** DEFINITIONS ***********************************************************************************************************/
+  //***************************************************************************************************************************/
+
+  /// CONSTRUCTOR
+  template<class... TYPES>
+  CSVStream<TYPES...>::CSVStream(const std::string& fileName, char separator, size_t bufferSize)
+    : _source{ openSource(fileName) }, _separator{ separator }, _buffer(bufferSize ? bufferSize : 1), _scanner{ separator } {}
+
+  /// Private method _nextLine
+  template<class... TYPES>
+  bool CSVStream<TYPES...>::_nextLine(std::string_view& line) {
+    size_t searched{ _begin };
+    while (true) {
+      const char* data{ _buffer.data() };
+      const char* eol{ static_cast<const char*>(memchr(data + searched, '\n', _end - searched)) };
+      // Lines with quotes, or continuing after the end of the buffer, are scanned to skip the line breaks inside quoted values
+      if (!eol || _scanner.quoted() || memchr(data + searched, '"', size_t(eol - data) - searched)) {
+        size_t pos{ _scanner.scan(std::string_view(data + searched, _end - searched)) };
+        eol = pos == std::string_view::npos ? nullptr : data + searched + pos;
+      }
+      else
+        _scanner.reset();
+
+      if (eol) {
+        size_t pos{ size_t(eol - data) };
+        line = std::string_view(data + _begin, pos - _begin);
+        _begin = pos + 1;
+        return true;
+      }
+
+      if (_eof) {
+        // Last line, not terminated by a line break
+        _scanner.reset();
+        if (_begin == _end) return false;
+        line = std::string_view(_buffer.data() + _begin, _end - _begin);
+        _begin = _end;
+        return true;
+      }
+
+      // Move the incomplete line to the start of the buffer, growing it only if the line fills it completely
+      size_t pending{ _end - _begin };
+      if (_begin)
+        memmove(_buffer.data(), _buffer.data() + _begin, pending);
+      else if (pending == _buffer.size())
+        _buffer.resize(_buffer.size() * 2);
+      _begin = 0;
+      _end = pending;
+      searched = pending;
+
+      size_t read{ _source(_buffer.data() + _end, _buffer.size() - _end) };
+      _eof = read < _buffer.size() - _end;
+      _end += read;
+    }
+  }
+
+  /// NEXT RECORD
+  template<class... TYPES>
+  bool CSVStream<TYPES...>::next() {
+    std::string_view line;
+    while (_nextLine(line)) {
+      bool found{ false };
+      _tokenizer(line, _separator, [&](const Tokens& tokens) {
+        std::string_view line{ tokens.line() };
+        if (line.length() == 0 || line[0] == '#' || line[0] == '!') return;
+
+        if (tokens.size() != sizeof...(TYPES))
+          throw std::range_error(std::string("Inconsistent CSV file. Line ") + std::to_string(_count + 1) + " contains " + std::to_string(tokens.size()) + " values. Expected " + std::to_string(sizeof...(TYPES)));
+
+        copyToTuple(_record, tokens, _count);
+        found = true;
+      });
+
+      if (found) {
+        ++_count;
+        return true;
+      }
+    }
+    return false;
+  }
+}
+
+#endif // CSV_STREAM_H
@@ -0,0 +1,267 @@
+//  MIT License
+//
+//  Copyright (c) 2018 Francisco de Lanuza
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+#ifndef FILE_BUFFER_H
+#define FILE_BUFFER_H
+
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <fstream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "block_source.h"
+
+
+namespace utils
+{
+  /**
+    *  \brief Read-only access to the whole content of a file.
+    *         Regular files are memory-mapped, so the content is read straight from the page cache without any copy.
+    *         Inputs which cannot be mapped (pipes, character devices, empty files...) are read into an internal buffer instead.
+    *         Compressed files (gzip or Zstandard, detected by their magic bytes) are decompressed into the internal buffer.
+    */
+  class FileBuffer
+  {
+  protected:
+    /**
+      *  Start of the mapped region, or nullptr if the content is stored in _buffer
+      */
+    const char* _mapped{ nullptr };
+
+    /**
+      *  Size of the mapped region
+      */
+    size_t _mappedSize{ 0 };
+
+    /**
+      *  Content of the file when it cannot be mapped
+      */
+    std::string _buffer;
+
+#ifdef _WIN32
+    HANDLE _mapping{ nullptr };
+#endif
+
+    /**
+      *  \brief Tries to map the file into memory
+      *  @param fileName [in] Name of the file
+      *  @return  false if the file cannot be mapped
+      *  @throw runtime_error File cannot be opened
+      */
+    bool _map(const std::string& fileName);
+
+    /**
+      *  \brief Reads the whole file into _buffer
+      *  @param fileName [in] Name of the file
+      *  @throw runtime_error File cannot be opened
+      */
+    void _read(const std::string& fileName);
+
+    /**
+      *  \brief Decompresses the whole content into _buffer
+      *  @param fileName [in] Name of the file, used in the error messages
+      *  @param compressed [in] Compressed content. It must not be stored in _buffer
+      *  @throw runtime_error Content is corrupted, or it is compressed in a format not compiled in
+      */
+    void _decompress(const std::string& fileName, std::string_view compressed);
+
+    /**
+      *  \brief Unmaps the file, if it was mapped
+      */
+    void _unmap();
+
+  public:
+    /**
+      *  \brief Constructor
+      *         Maps the file into memory or, if that is not possible, reads its whole content
+      *  @param fileName [in] Name of the file
+      *  @throw runtime_error File cannot be opened or decompressed
+      */
+    explicit FileBuffer(const std::string& fileName);
+
+    FileBuffer(const FileBuffer&) = delete;
+    FileBuffer& operator=(const FileBuffer&) = delete;
+
+    ~FileBuffer() { _unmap(); }
+
+    /**
+      *  \brief Returns a pointer to the first character of the file
+      *  @return  pointer to the content
+      */
+    const char* data() const { return _mapped ? _mapped : _buffer.data(); }
+
+    /**
+      *  \brief Returns the size of the file in bytes
+      *  @return  the number of bytes
+      */
+    size_t size() const { return _mapped ? _mappedSize : _buffer.size(); }
+
+    /**
+      *  \brief Returns the whole content of the file
+      *  @return  a string_view over the content
+      */
+    std::string_view view() const { return std::string_view(data(), size()); }
+
+    /**
+      *  \brief Indicates whether the file is memory-mapped or has been read into memory
+      *  @return  true if the file is memory-mapped
+      */
+    bool mapped() const { return _mapped != nullptr; }
+  };
+
+
+  //*** DEFINITIONS ***********************************************************************************************************/
+  //***************************************************************************************************************************/
+
+  /// CONSTRUCTOR
+  inline FileBuffer::FileBuffer(const std::string& fileName) {
+    if (!_map(fileName)) {
+      _read(fileName);
+      // Pipes may carry compressed content too
+      if (detectCompression(view()) != Compression::NONE) {
+        std::string compressed;
+        compressed.swap(_buffer);
+        _decompress(fileName, compressed);
+      }
+    }
+    else if (detectCompression(view()) != Compression::NONE) {
+      // Decompressed straight from the mapping. The destructor does not run if the constructor throws
+      try {
+        _decompress(fileName, view());
+      }
+      catch (...) {
+        _unmap();
+        throw;
+      }
+      _unmap();
+    }
+  }
+
+#ifdef _WIN32
+  inline bool FileBuffer::_map(const std::string& fileName) {
+    HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+      throw std::runtime_error("File cannot be opened: " + fileName);
+
+    LARGE_INTEGER fileSize;
+    if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+      CloseHandle(file);
+      return false;
+    }
+
+    _mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!_mapping)
+      return false;
+
+    _mapped = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!_mapped) {
+      CloseHandle(_mapping);
+      _mapping = nullptr;
+      return false;
+    }
+    _mappedSize = size_t(fileSize.QuadPart);
+    return true;
+  }
+
+  inline void FileBuffer::_unmap() {
+    if (_mapped) UnmapViewOfFile(_mapped);
+    if (_mapping) CloseHandle(_mapping);
+    _mapped = nullptr;
+    _mapping = nullptr;
+  }
+#else
+  inline bool FileBuffer::_map(const std::string& fileName) {
+    // Pipes and devices are not opened here, since _read must be the only one to open them: a pipe cannot be read twice
+    struct stat st;
+    if (::stat(fileName.c_str(), &st) == 0 && !S_ISREG(st.st_mode))
+      return false;
+
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("File cannot be opened: " + fileName);
+
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+      ::close(fd);
+      return false;
+    }
+
+    void* addr = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+      return false;
+
+    ::madvise(addr, size_t(st.st_size), MADV_SEQUENTIAL);
+    _mapped = static_cast<const char*>(addr);
+    _mappedSize = size_t(st.st_size);
+    return true;
+  }
+
+  inline void FileBuffer::_unmap() {
+    if (_mapped) ::munmap(const_cast<char*>(_mapped), _mappedSize);
+    _mapped = nullptr;
+  }
+#endif
+
+  inline void FileBuffer::_read(const std::string& fileName) {
+    std::ifstream file(fileName, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+      throw std::runtime_error("File cannot be opened: " + fileName);
+
+    // The size of a pipe is unknown, so read it in blocks
+    constexpr size_t BLOCK_SIZE{ 1 << 16 };
+    while (file) {
+      size_t used{ _buffer.size() };
+      _buffer.resize(used + BLOCK_SIZE);
+      file.read(_buffer.data() + used, BLOCK_SIZE);
+      _buffer.resize(used + size_t(file.gcount()));
+    }
+  }
+
+  inline void FileBuffer::_decompress(const std::string& fileName, std::string_view compressed) {
+    BlockSource source{ decompressSource(detectCompression(compressed), memorySource(compressed), fileName) };
+    // Text is usually compressed to less than a quarter of its size
+    _buffer.reserve(compressed.size() * 4);
+    constexpr size_t BLOCK_SIZE{ 1 << 20 };
+    while (true) {
+      size_t used{ _buffer.size() };
+      _buffer.resize(used + BLOCK_SIZE);
+      size_t read{ source(_buffer.data() + used, BLOCK_SIZE) };
+      _buffer.resize(used + read);
+      if (read < BLOCK_SIZE) break;
+    }
+  }
+}
+
+#endif // FILE_BUFFER_H
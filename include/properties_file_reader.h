@@ -24,12 +24,20 @@
 #define PROPERTIES_FILE_READER_H
 
 #include <string>
-#include <map>
+#include <string_view>
 #include <vector>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include <limits>
 #include <type_traits>
 #include <stdexcept>
 #include <fstream>
 
+#include "string_converter.h"
+
 
 namespace utils
 {
@@ -39,15 +47,92 @@ namespace utils
     *           Property keys can be duplicated
     *           Commented lines (starting with '#' or '!') and invalid lines are discarded.
     *           Leading and trailing spaces are removed.
+    *           The keys are found in a flat hash table, looked up by string_view without any allocation.
+    *           Numeric and boolean values are converted once, when the file is read. The reader is not modified by the lookups,
+    *           so it can be shared by concurrent threads.
+    *           Keys queried often can be resolved once into handles, so their lookups are a plain array index.
+    *           The keys starting with a prefix (like "db.pool.") are found with a binary search in the sorted keys, without copying them.
     *           Only ASCII characters are supported!
   */
   class PropertiesFileReader
   {
+  public:
+    /**
+      *  \brief Key resolved by handle(). It holds the position of its values, so it is only valid for the reader which resolved it
+      */
+    class Handle
+    {
+      friend class PropertiesFileReader;
+
+      size_t _entry;   ///< Position of the key in _entries
+      size_t _first;   ///< Position of the first value in _values
+      size_t _count;   ///< Number of values
+
+      Handle(size_t entry, size_t first, size_t count) : _entry{ entry }, _first{ first }, _count{ count } {}
+    };
+
+    class PrefixRange;
+
   protected:
     /**
-      *  Multimap used to store in memory the content of the file
+      *  \brief Distinct property key, with the range of its values
+      */
+    struct Entry
+    {
+      std::string key;
+      size_t first;   ///< Position of the first value in _values
+      size_t count;   ///< Number of values
+    };
+
+    /**
+      *  Distinct keys, sorted
+      */
+    std::vector<Entry> _entries;
+
+    /**
+      *  Values of all the properties, grouped by key in the order of _entries. The values of each key keep the order of the file
       */
-    std::multimap<std::string, std::string> _properties;
+    std::vector<std::string> _values;
+
+    /**
+      *  \brief Value of a property converted to the widest types. Narrower types are checked against their range
+      */
+    struct Converted
+    {
+      int64_t integer{ 0 };
+      uint64_t natural{ 0 };
+      double real{ 0 };
+      float single{ 0 };   ///< Converted on its own, since rounding a double to float may differ from parsing it as a float
+      uint8_t valid{ 0 };  ///< Bit mask of the valid conversions
+    };
+
+    /**
+      *  Bits of Converted::valid
+      */
+    enum : uint8_t { INTEGER = 1, NATURAL = 2, REAL = 4, SINGLE = 8, BOOLEAN = 16, TRUE_VALUE = 32 };
+
+    /**
+      *  Converted values, in the order of _values
+      */
+    std::vector<Converted> _converted;
+
+    /**
+      *  Open addressing hash table of the keys, with linear probing. Each slot holds the position of an entry plus one, or 0 if empty.
+      *  Its size is a power of two, more than twice the number of keys, so the probe sequences are short
+      */
+    std::vector<uint32_t> _slots;
+
+    /**
+      *  \brief Builds the hash table of the entries
+      */
+    void _index();
+
+    /**
+      *  \brief Finds the entry of a key
+      *  @param key [in] key to be found
+      *  @return  the entry, or nullptr if there is no property with the key
+      */
+    const Entry* _find(std::string_view key) const;
 
 
   public:
@@ -72,17 +157,18 @@ namespace utils
       *  @return  a vector which contains the values with the specified key
       *  @throw  runtime_error if the value cannot be converted to the given type
       */
-    template <class TYPE = std::string, typename = std::enable_if<std::is_arithmetic<TYPE>::value || std::is_same<TYPE, std::string>::value> >
-    std::vector<TYPE> values(const std::string& key) const;
+    template <class TYPE = std::string, typename = std::enable_if<is_convertible_value<TYPE>::value> >
+    std::vector<TYPE> values(std::string_view key) const;
 
     /**
       *  \brief Returns the first value of the properties with the specified key, converted to type T
       *  @param key [in] key which value has to be returned
       *  @return  a TYPE which contains the first value for the properties with the specified key
       *  @throw  out_of_range exception if there is no property with the specified key
+      *  @throw  runtime_error if the value cannot be converted to the given type
       */
-    template <class TYPE = std::string, typename = std::enable_if<std::is_arithmetic<TYPE>::value || std::is_same<TYPE, std::string>::value> >
-    TYPE value(const std::string& key) const;
+    template <class TYPE = std::string, typename = std::enable_if<is_convertible_value<TYPE>::value> >
+    TYPE value(std::string_view key) const;
 
     /**
      *  \brief Returns the first value of the properties with the specified key, as a string
@@ -90,18 +176,130 @@ namespace utils
      *  @return  a string which contains the first value for the properties with the specified key
      *  @throw  out_of_range exception if there is no property with the specified key
      */
-    std::string operator[](const std::string& key) const { return this->value(key); }
+    std::string operator[](std::string_view key) const { return this->value(key); }
+
+    /**
+      *  \brief Resolves a key into a handle, for lookups without hashing the key again
+      *  @param key [in] key to be resolved
+      *  @return  the handle of the key
+      *  @throw  out_of_range exception if there is no property with the specified key
+      */
+    Handle handle(std::string_view key) const;
+
+    /**
+      *  \brief Returns the values of the properties of a resolved key, converted to type TYPE
+      *  @param key [in] handle of the key, resolved by this reader
+      *  @return  a vector which contains the values of the key
+      *  @throw  runtime_error if the value cannot be converted to the given type
+      */
+    template <class TYPE = std::string, typename = std::enable_if<is_convertible_value<TYPE>::value> >
+    std::vector<TYPE> values(const Handle& key) const;
+
+    /**
+      *  \brief Returns the first value of the properties of a resolved key, converted to type TYPE
+      *  @param key [in] handle of the key, resolved by this reader
+      *  @return  a TYPE which contains the first value of the key
+      *  @throw  runtime_error if the value cannot be converted to the given type
+      */
+    template <class TYPE = std::string, typename = std::enable_if<is_convertible_value<TYPE>::value> >
+    TYPE value(const Handle& key) const { return _convert<TYPE>(_entries[key._entry].key, key._first); }
+
+    /**
+      *  \brief Returns the first value of the properties of a resolved key, as a string
+      *  @param key [in] handle of the key, resolved by this reader
+      *  @return  a string which contains the first value of the key
+      */
+    std::string operator[](const Handle& key) const { return _values[key._first]; }
+
+    /**
+      *  \brief Returns the keys starting with a prefix, in order. The keys are not copied: the range refers to this reader
+      *  @param prefix [in] prefix of the keys, like "db.pool.". An empty prefix gives all the keys
+      *  @return  a range of pairs with each key and its handle
+      */
+    PrefixRange withPrefix(std::string_view prefix) const;
+
+  protected:
+    /**
+      *  \brief Converts a property value to the widest types
+      *  @param text [in] value of the property
+      *  @return  the converted values
+      */
+    static Converted _convertAll(const std::string& text);
+
+    /**
+      *  \brief Returns a property value as type TYPE. Numbers and booleans are taken from the values converted in advance
+      *  @param key [in] key of the property, used in error messages
+      *  @param pos [in] position of the value in _values
+      *  @return  the converted value
+      *  @throw  runtime_error if the value cannot be converted to the given type
+      */
+    template <class TYPE>
+    TYPE _convert(std::string_view key, size_t pos) const;
+  };
+
+  /**
+    *  \brief Range of consecutive keys of a PropertiesFileReader. Each element is a pair with a view of the key and its handle
+    */
+  class PropertiesFileReader::PrefixRange
+  {
+    friend class PropertiesFileReader;
+
+    const Entry* _base;    ///< First entry of the reader, to compute the handles
+    const Entry* _begin;
+    const Entry* _end;
+
+    PrefixRange(const Entry* base, const Entry* begin, const Entry* end) : _base{ base }, _begin{ begin }, _end{ end } {}
+
+  public:
+    /**
+      *  \brief Forward iterator through the keys of the range
+      */
+    class iterator
+    {
+      const Entry* _base;
+      const Entry* _entry;
+
+    public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = std::pair<std::string_view, Handle>;
+      using difference_type = std::ptrdiff_t;
+      using pointer = void;
+      using reference = value_type;
+
+      iterator(const Entry* base, const Entry* entry) : _base{ base }, _entry{ entry } {}
+      value_type operator*() const { return value_type(_entry->key, Handle(size_t(_entry - _base), _entry->first, _entry->count)); }
+      iterator& operator++() { ++_entry; return *this; }
+      iterator operator++(int) { iterator previous{ *this }; ++_entry; return previous; }
+      bool operator==(const iterator& other) const { return _entry == other._entry; }
+      bool operator!=(const iterator& other) const { return _entry != other._entry; }
+    };
+
+    iterator begin() const { return iterator(_base, _begin); }
+    iterator end() const { return iterator(_base, _end); }
+
+    /**
+      *  \brief Returns the number of keys in the range
+      *  @return  the number of keys
+      */
+    size_t size() const { return size_t(_end - _begin); }
+
+    /**
+      *  \brief Indicates whether no key starts with the prefix
+      *  @return  true if the range is empty
+      */
+    bool empty() const { return _begin == _end; }
   };
 
 
   /// CONSTRUCTOR
-  PropertiesFileReader::PropertiesFileReader(const std::string& fileName, const char separator) {
+  inline PropertiesFileReader::PropertiesFileReader(const std::string& fileName, const char separator) {
 
     // Open file
     std::ifstream propFile(fileName, std::ios::in);
     if (!propFile.is_open())
       throw std::runtime_error("File cannot be opened: " + fileName);
 
+    std::vector<std::pair<std::string, std::string>> properties;
     try {
       // Read all not commented or blank lines
       std::string line;
@@ -129,7 +327,7 @@ namespace utils
         while (value[--i]<0 ||  isspace(value[i]));
         value.erase(++i);
 
-        _properties.insert(std::make_pair(key, value));
+        properties.emplace_back(std::move(key), std::move(value));
       }
     }
     catch (std::exception& e) {
@@ -138,38 +336,93 @@ namespace utils
 
     // Close file
     propFile.close();
+
+    // The values of each key are stored together, keeping the order of the file
+    std::stable_sort(properties.begin(), properties.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    _values.reserve(properties.size());
+    _converted.reserve(properties.size());
+    for (auto& property : properties) {
+      if (_entries.empty() || _entries.back().key != property.first)
+        _entries.push_back(Entry{ std::move(property.first), _values.size(), 0 });
+      _converted.push_back(_convertAll(property.second));
+      _values.push_back(std::move(property.second));
+      ++_entries.back().count;
+    }
+    _index();
   }
 
-  std::vector<std::string> PropertiesFileReader::keys() const {
-    std::vector<std::string> res;
-    for (auto& kv : _properties) {
-      if (!res.size() || res.back() != kv.first) res.push_back(kv.first);
+  /// Private method _index
+  inline void PropertiesFileReader::_index() {
+    size_t size{ 2 };
+    while (size <= 2 * _entries.size())
+      size *= 2;
+    _slots.assign(size, 0);
+
+    const size_t mask{ size - 1 };
+    for (size_t e = 0; e < _entries.size(); ++e) {
+      size_t i{ std::hash<std::string_view>()(_entries[e].key) & mask };
+      while (_slots[i])
+        i = (i + 1) & mask;
+      _slots[i] = uint32_t(e + 1);
     }
+  }
+
+  /// Private method _find
+  inline const PropertiesFileReader::Entry* PropertiesFileReader::_find(std::string_view key) const {
+    // There is always an empty slot, which ends the probe sequence
+    const size_t mask{ _slots.size() - 1 };
+    for (size_t i = std::hash<std::string_view>()(key) & mask; _slots[i]; i = (i + 1) & mask) {
+      const Entry& entry{ _entries[_slots[i] - 1] };
+      if (entry.key == key)
+        return &entry;
+    }
+    return nullptr;
+  }
+
+  /// KEYS
+  inline std::vector<std::string> PropertiesFileReader::keys() const {
+    std::vector<std::string> res;
+    res.reserve(_entries.size());
+    for (auto& entry : _entries)
+      res.push_back(entry.key);
     return res;
   }
 
 
+  /// HANDLE
+  inline PropertiesFileReader::Handle PropertiesFileReader::handle(std::string_view key) const {
+    if (const Entry* entry = _find(key))
+      return Handle(size_t(entry - _entries.data()), entry->first, entry->count);
+    throw std::out_of_range("Property not found: " + std::string(key));
+  }
+
+
+  /// WITH PREFIX
+  inline PropertiesFileReader::PrefixRange PropertiesFileReader::withPrefix(std::string_view prefix) const {
+    // The keys starting with the prefix are consecutive, since they are sorted
+    const Entry* base{ _entries.data() };
+    const Entry* begin{ std::lower_bound(base, base + _entries.size(), prefix, [](const Entry& entry, std::string_view prefix) { return entry.key < prefix; }) };
+    const Entry* end{ std::partition_point(begin, base + _entries.size(), [prefix](const Entry& entry) { return entry.key.compare(0, prefix.size(), prefix) == 0; }) };
+    return PrefixRange(base, begin, end);
+  }
+
+
+  /// VALUES
   template <class TYPE, typename >
-  std::vector<TYPE> PropertiesFileReader::values(const std::string& key) const {
-    auto match_iter{ _properties.equal_range(key) };
+  std::vector<TYPE> PropertiesFileReader::values(std::string_view key) const {
+    if (const Entry* entry = _find(key))
+      return values<TYPE>(Handle(size_t(entry - _entries.data()), entry->first, entry->count));
+    return std::vector<TYPE>();
+  }
 
+  /// VALUES OF A HANDLE
+  template <class TYPE, typename >
+  std::vector<TYPE> PropertiesFileReader::values(const Handle& key) const {
     std::vector<TYPE> values;
     try {
-      if (match_iter.first != _properties.end()) {
-        while (match_iter.first != match_iter.second) {
-          if constexpr (std::is_same<TYPE, std::string>::value)
-            values.push_back(match_iter.first->second);
-          else {
-            if constexpr (std::is_floating_point<TYPE>::value)
-              values.push_back(TYPE(atof((match_iter.first->second).c_str())));
-            else if constexpr (sizeof(TYPE) > sizeof(int))
-              values.push_back(TYPE(atol((match_iter.first->second).c_str())));
-            else
-              values.push_back(TYPE(atoi((match_iter.first->second).c_str())));
-          }
-          ++match_iter.first;
-        }
-      }
+      values.reserve(key._count);
+      for (size_t i = key._first; i < key._first + key._count; ++i)
+        values.push_back(_convert<TYPE>(_entries[key._entry].key, i));
     }
     catch (std::exception& e) {
       throw std::runtime_error(e.what());
@@ -179,25 +432,66 @@ namespace utils
   }
 
 
+  /// VALUE
   template <class TYPE, typename >
-  TYPE PropertiesFileReader::value(const std::string& key) const {
-    auto match_iter = _properties.equal_range(key);
-    if (match_iter.first != _properties.end() && match_iter.first != match_iter.second) {
-      if constexpr (std::is_same<TYPE, std::string>::value)
-        return match_iter.first->second;
-      else {
-        if constexpr (std::is_floating_point<TYPE>::value)
-          return TYPE(atof((match_iter.first->second).c_str()));
-        else if constexpr (sizeof(TYPE) > sizeof(int))
-          return TYPE(atol((match_iter.first->second).c_str()));
-        else
-          return TYPE(atoi((match_iter.first->second).c_str()));
+  TYPE PropertiesFileReader::value(std::string_view key) const {
+    if (const Entry* entry = _find(key))
+      return _convert<TYPE>(key, entry->first);
+    else
+      throw std::out_of_range("Property not found: " + std::string(key));
+  }
+
+
+  /// Private method _convertAll
+  inline PropertiesFileReader::Converted PropertiesFileReader::_convertAll(const std::string& text) {
+    Converted converted;
+    bool boolean{ false };
+    if (fromString(text, converted.integer)) converted.valid |= INTEGER;
+    if (fromString(text, converted.natural)) converted.valid |= NATURAL;
+    if (fromString(text, converted.real)) converted.valid |= REAL;
+    if (fromString(text, converted.single)) converted.valid |= SINGLE;
+    if (fromString(text, boolean)) converted.valid |= BOOLEAN | (boolean ? TRUE_VALUE : 0);
+    return converted;
+  }
+
+  /// Private method _convert
+  template <class TYPE>
+  TYPE PropertiesFileReader::_convert(std::string_view key, size_t pos) const {
+    if constexpr (std::is_same<TYPE, std::string>::value)
+      return _values[pos];
+    else {
+      const Converted& converted{ _converted[pos] };
+      TYPE value{};
+      bool valid;
+      if constexpr (std::is_same<TYPE, bool>::value) {
+        valid = converted.valid & BOOLEAN;
+        value = converted.valid & TRUE_VALUE;
+      }
+      else if constexpr (std::is_same<TYPE, double>::value) {
+        valid = converted.valid & REAL;
+        value = converted.real;
       }
+      else if constexpr (std::is_same<TYPE, float>::value) {
+        valid = converted.valid & SINGLE;
+        value = converted.single;
+      }
+      else if constexpr (std::is_integral<TYPE>::value && std::is_signed<TYPE>::value && sizeof(TYPE) <= sizeof(int64_t)) {
+        valid = (converted.valid & INTEGER) && converted.integer >= std::numeric_limits<TYPE>::min() && converted.integer <= std::numeric_limits<TYPE>::max();
+        value = TYPE(converted.integer);
+      }
+      else if constexpr (std::is_integral<TYPE>::value && std::is_unsigned<TYPE>::value && sizeof(TYPE) <= sizeof(uint64_t)) {
+        valid = (converted.valid & NATURAL) && converted.natural <= std::numeric_limits<TYPE>::max();
+        value = TYPE(converted.natural);
+      }
+      else
+        valid = fromString(_values[pos], value);
+
+      if (!valid)
+        throw std::runtime_error("Invalid value for property " + std::string(key) + ": '" + _values[pos] + "'");
+      return value;
     }
-    else
-      throw std::out_of_range("Property not found: " + key);
   }
-  
+
 }
 
 #endif // PROPERTIES_FILE_READER_H
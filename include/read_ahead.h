@@ -0,0 +1,329 @@
+//  MIT License
+//
+//  Copyright (c) 2018 Francisco de Lanuza
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <new>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#include "block_source.h"
+#include "simd_tokenizer.h"
+
+
+namespace utils
+{
+  /**
+    *  \brief Reads a file ahead, in large blocks, on a background thread.
+    *         The blocks are stored in a ring of aligned buffers: while the consumer works on a block, the thread fills the next ones,
+    *         so the disk and the CPU are kept busy at the same time. With a depth of 2 it is double buffered, with 3 triple buffered...
+    *         Compressed files are decompressed by the thread, so the decompression overlaps the work of the consumer too.
+    */
+  class ReadAhead
+  {
+  protected:
+    /**
+      *  \brief Buffer of the ring
+      */
+    struct Buffer
+    {
+      char* data{ nullptr };
+      size_t size{ 0 };       ///< Number of bytes filled
+      bool filled{ false };   ///< Filled by the thread and not released by the consumer yet
+    };
+
+    /**
+      *  Source of the blocks, only used by the thread
+      */
+    BlockSource _source;
+
+    /**
+      *  Size of each buffer
+      */
+    size_t _bufferSize;
+
+    /**
+      *  Ring of buffers. Buffer i holds the blocks i, i + depth, i + 2 * depth...
+      */
+    std::vector<Buffer> _buffers;
+
+    /**
+      *  Next buffer to be returned to the consumer
+      */
+    size_t _next{ 0 };
+
+    /**
+      *  The last buffer returned is still in use by the consumer
+      */
+    bool _inUse{ false };
+
+    /**
+      *  The whole file has been read, or the reading failed
+      */
+    bool _done{ false };
+
+    /**
+      *  The consumer is being destroyed: the thread must stop
+      */
+    bool _stop{ false };
+
+    /**
+      *  Error of the thread, thrown to the consumer
+      */
+    std::exception_ptr _error;
+
+    std::mutex _mutex;
+    std::condition_variable _filled;
+    std::condition_variable _released;
+
+    /**
+      *  Background thread
+      */
+    std::thread _thread;
+
+    /**
+      *  \brief Body of the background thread: fills the buffers in turns, until the end of the source
+      */
+    void _run();
+
+  public:
+    /**
+      *  Alignment of the buffers
+      */
+    static constexpr size_t ALIGNMENT{ 4096 };
+
+    /**
+      *  \brief Constructor
+      *         Starts reading the source
+      *  @param source [in] Source of the blocks
+      *  @param bufferSize [in] Size of each block. It is rounded up to a multiple of the alignment
+      *  @param depth [in] Number of buffers. At least 2: one filled by the thread while the consumer works on another
+      */
+    ReadAhead(BlockSource source, size_t bufferSize = 1 << 20, size_t depth = 3);
+
+    /**
+      *  \brief Constructor
+      *         Starts reading the file. Compressed files are detected by their magic bytes
+      *  @param fileName [in] Name of the file
+      *  @param bufferSize [in] Size of each block. It is rounded up to a multiple of the alignment
+      *  @param depth [in] Number of buffers. At least 2: one filled by the thread while the consumer works on another
+      *  @throw runtime_error File cannot be opened, or it is compressed in a format not compiled in
+      */
+    ReadAhead(const std::string& fileName, size_t bufferSize = 1 << 20, size_t depth = 3) : ReadAhead(openSource(fileName), bufferSize, depth) {}
+
+    ReadAhead(const ReadAhead&) = delete;
+    ReadAhead& operator=(const ReadAhead&) = delete;
+
+    ~ReadAhead();
+
+    /**
+      *  \brief Returns the next block of the file, waiting until it has been read. The previous block is released
+      *  @return  a view of the block, valid until the next call. Empty at the end of the file
+      *  @throw runtime_error The file cannot be read
+      */
+    std::string_view next();
+  };
+
+  /**
+    *  \brief Reads a file through a ReadAhead pipeline, and calls func with groups of whole records.
+    *         The records are passed straight from the buffers, except those which span two of them
+    *  @param fileName [in] Name of the file. It may be compressed
+    *  @param separator [in] Character used as value separator, to find the quoted values
+    *  @param bufferSize [in] Size of each block read ahead
+    *  @param depth [in] Number of buffers
+    *  @param func [in] Callable object receiving a string_view with one or more whole lines. If it returns a bool, false stops the reading
+    *  @throw runtime_error File cannot be opened or read
+    */
+  template<class FUNC>
+  void readBlocks(const std::string& fileName, char separator, size_t bufferSize, size_t depth, FUNC&& func);
+
+  /**
+    *  \brief Calls func with groups of whole records, taken from a sequence of blocks.
+    *         The records are passed straight from the blocks, except those which span two of them
+    *  @param next [in] Callable object returning the next block as a string_view, valid until the next call. Empty at the end
+    *  @param separator [in] Character used as value separator, to find the quoted values
+    *  @param func [in] Callable object receiving a string_view with one or more whole lines. If it returns a bool, false stops the reading
+    */
+  template<class NEXT, class FUNC>
+  void splitRecords(NEXT&& next, char separator, FUNC&& func);
+
+
+  //*** DEFINITIONS ***********************************************************************************************************/
+  //***************************************************************************************************************************/
+
+  /// CONSTRUCTOR
+  inline ReadAhead::ReadAhead(BlockSource source, size_t bufferSize, size_t depth)
+    : _source{ std::move(source) }, _bufferSize{ (std::max(bufferSize, size_t(1)) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT }, _buffers(std::max(depth, size_t(2))) {
+    for (auto& buffer : _buffers)
+      buffer.data = static_cast<char*>(::operator new[](_bufferSize, std::align_val_t(ALIGNMENT)));
+    try {
+      _thread = std::thread(&ReadAhead::_run, this);
+    }
+    catch (...) {
+      for (auto& buffer : _buffers)
+        ::operator delete[](buffer.data, std::align_val_t(ALIGNMENT));
+      throw;
+    }
+  }
+
+  /// DESTRUCTOR
+  inline ReadAhead::~ReadAhead() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _released.notify_all();
+    _thread.join();
+    for (auto& buffer : _buffers)
+      ::operator delete[](buffer.data, std::align_val_t(ALIGNMENT));
+  }
+
+  /// Private method _run
+  inline void ReadAhead::_run() {
+    try {
+      for (size_t i = 0; ; i = (i + 1) % _buffers.size()) {
+        Buffer& buffer{ _buffers[i] };
+        {
+          std::unique_lock<std::mutex> lock(_mutex);
+          _released.wait(lock, [this, &buffer]() { return _stop || !buffer.filled; });
+          if (_stop) break;
+        }
+
+        // The buffer is not touched by the consumer until it is marked as filled
+        size_t size{ _source(buffer.data, _bufferSize) };
+        bool last{ size < _bufferSize };
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          buffer.size = size;
+          buffer.filled = true;
+          _done = last;
+        }
+        _filled.notify_one();
+        if (last) break;
+      }
+    }
+    catch (...) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _error = std::current_exception();
+      _done = true;
+      _filled.notify_one();
+    }
+  }
+
+  /// NEXT
+  inline std::string_view ReadAhead::next() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_inUse) {
+      _buffers[_next].filled = false;
+      _next = (_next + 1) % _buffers.size();
+      _inUse = false;
+      _released.notify_one();
+    }
+
+    Buffer& buffer{ _buffers[_next] };
+    _filled.wait(lock, [this, &buffer]() { return buffer.filled || _done; });
+    if (!buffer.filled) {
+      if (_error) std::rethrow_exception(_error);
+      return std::string_view();
+    }
+    _inUse = true;
+    return std::string_view(buffer.data, buffer.size);
+  }
+
+  /// READ BLOCKS
+  template<class FUNC>
+  void readBlocks(const std::string& fileName, char separator, size_t bufferSize, size_t depth, FUNC&& func) {
+    ReadAhead reader(fileName, bufferSize, depth);
+    splitRecords([&reader]() { return reader.next(); }, separator, std::forward<FUNC>(func));
+  }
+
+  /// SPLIT RECORDS
+  template<class NEXT, class FUNC>
+  void splitRecords(NEXT&& next, char separator, FUNC&& func) {
+    RecordScanner scanner(separator);
+    // Start of a record which continues in the next block
+    std::string pending;
+    auto call = [&func](std::string_view text) {
+      if constexpr (std::is_same<decltype(func(text)), bool>::value)
+        return func(text);
+      else {
+        func(text);
+        return true;
+      }
+    };
+
+    for (std::string_view block = next(); !block.empty(); block = next()) {
+      // Positions following the first and the last line breaks which end a record
+      size_t first{ std::string_view::npos };
+      size_t last{ std::string_view::npos };
+      if (!scanner.quoted() && !memchr(block.data(), '"', block.size())) {
+        const char* eol{ static_cast<const char*>(memchr(block.data(), '\n', block.size())) };
+        if (eol) {
+          first = size_t(eol - block.data()) + 1;
+          last = block.rfind('\n') + 1;
+          scanner.reset();
+        }
+        // The scanner must know whether the incomplete record ends at the start of a value
+        scanner.scan(block.substr(last == std::string_view::npos ? 0 : last));
+      }
+      else {
+        for (size_t pos = 0, found; pos < block.size() && (found = scanner.scan(block.substr(pos))) != std::string_view::npos; pos += found + 1) {
+          if (first == std::string_view::npos)
+            first = pos + found + 1;
+          last = pos + found + 1;
+        }
+      }
+
+      if (last == std::string_view::npos) {
+        pending.append(block);
+        continue;
+      }
+      size_t start{ 0 };
+      if (!pending.empty()) {
+        pending.append(block.substr(0, first));
+        if (!call(std::string_view(pending))) return;
+        pending.clear();
+        start = first;
+      }
+      if (start < last && !call(block.substr(start, last - start)))
+        return;
+      pending.assign(block.substr(last));
+    }
+
+    if (!pending.empty())
+      call(std::string_view(pending));
+  }
+}
+
+#endif // READ_AHEAD_H
@@ -0,0 +1,461 @@
+//  MIT License
+//
+//  Copyright (c) 2018 Francisco de Lanuza
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+
+#ifndef RELOADABLE_PROPERTIES_H
+#define RELOADABLE_PROPERTIES_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <filesystem>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#include "properties_file_reader.h"
+
+
+namespace utils
+{
+  /**
+    *  \brief Properties file which is reloaded when it changes.
+    *         Each version of the file is parsed on a background thread into an immutable PropertiesFileReader (a snapshot), which is
+    *         published through an atomic pointer. Readers never block or take a lock: they register in one of two counters, load
+    *         the pointer and unregister when they are done. Publishing never waits for the readers either: the replaced snapshot is
+    *         retired, and deleted by a later publication or by the destructor once no reader can be using it (RCU-like).
+    *         On Linux the directory of the file is watched with inotify, and the file is reloaded when it is closed after being
+    *         written or renamed over. Elsewhere, or if inotify is not available, its modification time and size are polled.
+    *         To never publish a half written file, it should be replaced atomically (written to a temporary file and renamed).
+    */
+  class ReloadableProperties
+  {
+  public:
+    /**
+      *  \brief Access to the current snapshot. The snapshot is not deleted while the object exists. It should be short lived, since the
+      *         snapshots replaced meanwhile are not deleted either. The file may be reloaded while it exists, even from the same thread
+      */
+    class Snapshot
+    {
+    protected:
+      const ReloadableProperties& _owner;
+      size_t _slot;
+      const PropertiesFileReader* _properties;
+
+    public:
+      /**
+        *  \brief Constructor
+        *         Registers the reader and takes the current snapshot. Lock free
+        *  @param owner [in] Object holding the snapshots
+        */
+      explicit Snapshot(const ReloadableProperties& owner);
+
+      Snapshot(const Snapshot&) = delete;
+      Snapshot& operator=(const Snapshot&) = delete;
+
+      ~Snapshot() { _owner._readers[_slot].count.fetch_sub(1, std::memory_order_release); }
+
+      const PropertiesFileReader& operator*() const { return *_properties; }
+      const PropertiesFileReader* operator->() const { return _properties; }
+    };
+
+  protected:
+    /**
+      *  \brief Counter of readers, in its own cache line
+      */
+    struct alignas(64) Readers
+    {
+      std::atomic<size_t> count{ 0 };
+    };
+
+    /**
+      *  Name of the properties file
+      */
+    std::string _fileName;
+
+    /**
+      *  Character used to separate key/values
+      */
+    char _separator;
+
+    /**
+      *  Interval between two polls of the file. With inotify, the thread only wakes up on changes
+      */
+    std::chrono::milliseconds _interval;
+
+    /**
+      *  Current snapshot, owned by this object
+      */
+    alignas(64) std::atomic<const PropertiesFileReader*> _current{ nullptr };
+
+    /**
+      *  Number of snapshots replaced so far. New readers register in the counter of its parity
+      */
+    std::atomic<uint64_t> _epoch{ 0 };
+
+    /**
+      *  Readers registered in each parity of the epoch
+      */
+    mutable Readers _readers[2];
+
+    /**
+      *  Number of snapshots published
+      */
+    std::atomic<size_t> _version{ 0 };
+
+    /**
+      *  Serializes the publications of the thread and of reload()
+      */
+    std::mutex _writer;
+
+    /**
+      *  \brief Replaced snapshot, kept until no reader can be using it
+      */
+    struct Retired
+    {
+      const PropertiesFileReader* properties;
+      bool drained[2]{ false, false };   ///< The counter of each parity has been seen empty since the snapshot was replaced
+    };
+
+    /**
+      *  Replaced snapshots. Guarded by _writer
+      */
+    std::vector<Retired> _retired;
+
+    /**
+      *  Stops the thread
+      */
+    bool _stop{ false };
+    std::mutex _mutex;
+    std::condition_variable _wake;
+
+    /**
+      *  inotify instance watching the directory of the file, and pipe waking up the thread, or -1
+      */
+    int _inotify{ -1 };
+    int _pipe[2]{ -1, -1 };
+
+    /**
+      *  Background thread
+      */
+    std::thread _thread;
+
+    /**
+      *  \brief Publishes a new snapshot, and retires the previous one. Does not wait for the readers
+      *  @param properties [in] New snapshot
+      */
+    void _publish(std::unique_ptr<const PropertiesFileReader> properties);
+
+    /**
+      *  \brief Deletes the retired snapshots which no reader can be using. Called with _writer locked
+      */
+    void _reclaim();
+
+    /**
+      *  \brief Body of the background thread: waits for changes of the file, and reloads it
+      */
+    void _run();
+
+    /**
+      *  \brief Waits until the file may have changed, or the object is being destroyed
+      *  @return  false if the thread must stop
+      */
+    bool _waitChange();
+
+    /**
+      *  \brief Returns the modification time and size of the file, to detect its changes while polling
+      *  @return  the pair of values, or a default pair if the file does not exist
+      */
+    std::pair<std::filesystem::file_time_type, uintmax_t> _stamp() const;
+
+  public:
+    /**
+      *  \brief Constructor
+      *         Reads the file, and starts watching it
+      *  @param fileName [in] Name of the properties file
+      *  @param separator [in] Character used to separate key/values
+      *  @param interval [in] Interval between two polls of the file, if it cannot be watched with inotify
+      *  @throw runtime_error File cannot be opened
+      */
+    ReloadableProperties(const std::string& fileName, char separator = '=', std::chrono::milliseconds interval = std::chrono::milliseconds(100));
+
+    ReloadableProperties(const ReloadableProperties&) = delete;
+    ReloadableProperties& operator=(const ReloadableProperties&) = delete;
+
+    ~ReloadableProperties();
+
+    /**
+      *  \brief Returns the current snapshot. Several lookups through the same snapshot see the same version of the file
+      *  @return  the snapshot
+      */
+    Snapshot snapshot() const { return Snapshot(*this); }
+
+    /**
+      *  \brief Returns the first value of the properties with the specified key in the current snapshot, converted to type TYPE
+      *  @param key [in] key which value has to be returned
+      *  @return  the first value for the properties with the specified key
+      *  @throw  out_of_range exception if there is no property with the specified key
+      *  @throw  runtime_error if the value cannot be converted to the given type
+      */
+    template <class TYPE = std::string>
+    TYPE value(std::string_view key) const { return snapshot()->template value<TYPE>(key); }
+
+    /**
+      *  \brief Returns the values of the properties with the specified key in the current snapshot, converted to type TYPE
+      *  @param key [in] key of the value(s) to be returned
+      *  @return  a vector which contains the values with the specified key
+      *  @throw  runtime_error if the value cannot be converted to the given type
+      */
+    template <class TYPE = std::string>
+    std::vector<TYPE> values(std::string_view key) const { return snapshot()->template values<TYPE>(key); }
+
+    /**
+      *  \brief Returns the first value of the properties with the specified key in the current snapshot, as a string
+      *  @param key [in] key which value has to be returned
+      *  @return  a string which contains the first value for the properties with the specified key
+      *  @throw  out_of_range exception if there is no property with the specified key
+      */
+    std::string operator[](std::string_view key) const { return value(key); }
+
+    /**
+      *  \brief Returns the different keys of the properties in the current snapshot
+      *  @return  a sorted vector which contains the keys
+      */
+    std::vector<std::string> keys() const { return snapshot()->keys(); }
+
+    /**
+      *  \brief Reads the file now, and publishes it if it can be read
+      *  @return  false if the file cannot be opened. The current snapshot is kept
+      */
+    bool reload();
+
+    /**
+      *  \brief Returns the number of snapshots published, including the first one
+      *  @return  the version of the current snapshot
+      */
+    size_t version() const { return _version.load(std::memory_order_acquire); }
+
+    /**
+      *  \brief Indicates whether the file is watched with inotify, instead of being polled
+      *  @return  true if the file is watched with inotify
+      */
+    bool watching() const { return _inotify >= 0; }
+  };
+
+
+  //*** DEFINITIONS ***********************************************************************************************************/
+  //***************************************************************************************************************************/
+
+  /// SNAPSHOT CONSTRUCTOR
+  inline ReloadableProperties::Snapshot::Snapshot(const ReloadableProperties& owner) : _owner{ owner } {
+    // If the epoch changes while registering, the writer may have missed this reader: it registers again in the new epoch
+    while (true) {
+      uint64_t epoch{ owner._epoch.load() };
+      _slot = size_t(epoch & 1);
+      owner._readers[_slot].count.fetch_add(1);
+      if (owner._epoch.load() == epoch)
+        break;
+      owner._readers[_slot].count.fetch_sub(1, std::memory_order_release);
+    }
+    _properties = owner._current.load();
+  }
+
+  /// CONSTRUCTOR
+  inline ReloadableProperties::ReloadableProperties(const std::string& fileName, char separator, std::chrono::milliseconds interval)
+    : _fileName{ fileName }, _separator{ separator }, _interval{ interval } {
+    _publish(std::make_unique<const PropertiesFileReader>(fileName, separator));
+
+#ifdef __linux__
+    // The directory is watched, instead of the file, so the watch survives the replacement of the file
+    _inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotify >= 0) {
+      std::filesystem::path directory{ std::filesystem::path(fileName).parent_path() };
+      if (directory.empty()) directory = ".";
+      if (inotify_add_watch(_inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0 || ::pipe2(_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        ::close(_inotify);
+        _inotify = -1;
+      }
+    }
+#endif
+
+    try {
+      _thread = std::thread(&ReloadableProperties::_run, this);
+    }
+    catch (...) {
+#ifdef __linux__
+      if (_inotify >= 0) {
+        ::close(_inotify);
+        ::close(_pipe[0]);
+        ::close(_pipe[1]);
+      }
+#endif
+      delete _current.load();
+      throw;
+    }
+  }
+
+  /// DESTRUCTOR
+  inline ReloadableProperties::~ReloadableProperties() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _wake.notify_all();
+#ifdef __linux__
+    if (_inotify >= 0) {
+      char stop{ 0 };
+      (void)!::write(_pipe[1], &stop, 1);
+    }
+#endif
+    _thread.join();
+
+#ifdef __linux__
+    if (_inotify >= 0) {
+      ::close(_inotify);
+      ::close(_pipe[0]);
+      ::close(_pipe[1]);
+    }
+#endif
+    delete _current.load();
+    // No snapshot can outlive the object, so no reader is left
+    for (auto& retired : _retired)
+      delete retired.properties;
+  }
+
+  /// Private method _publish
+  inline void ReloadableProperties::_publish(std::unique_ptr<const PropertiesFileReader> properties) {
+    std::lock_guard<std::mutex> lock(_writer);
+    const PropertiesFileReader* old{ _current.exchange(properties.release()) };
+    // Readers registering from now on go to the other counter, so the counter of the previous epoch drains
+    _epoch.fetch_add(1);
+    if (old)
+      _retired.push_back(Retired{ old });
+    _reclaim();
+    _version.fetch_add(1, std::memory_order_release);
+  }
+
+  /// Private method _reclaim
+  inline void ReloadableProperties::_reclaim() {
+    // A reader holding a retired snapshot registered before it was replaced, but not necessarily in the parity of the epoch in
+    // which it was replaced: it may have registered between the exchange of the pointer and the change of the epoch. The snapshot
+    // is deleted once both counters have been seen empty since it was replaced. Each publication lets the older counter drain
+    size_t kept{ 0 };
+    for (auto& retired : _retired) {
+      for (size_t parity = 0; parity < 2; ++parity)
+        retired.drained[parity] = retired.drained[parity] || !_readers[parity].count.load();
+      if (retired.drained[0] && retired.drained[1])
+        delete retired.properties;
+      else
+        _retired[kept++] = retired;
+    }
+    _retired.resize(kept);
+  }
+
+  /// RELOAD
+  inline bool ReloadableProperties::reload() {
+    std::unique_ptr<const PropertiesFileReader> properties;
+    try {
+      properties = std::make_unique<const PropertiesFileReader>(_fileName, _separator);
+    }
+    catch (std::runtime_error&) {
+      // The file may be missing for a while, while it is replaced
+      return false;
+    }
+    _publish(std::move(properties));
+    return true;
+  }
+
+  /// Private method _stamp
+  inline std::pair<std::filesystem::file_time_type, uintmax_t> ReloadableProperties::_stamp() const {
+    std::error_code error;
+    auto time{ std::filesystem::last_write_time(_fileName, error) };
+    if (error)
+      return {};
+    uintmax_t size{ std::filesystem::file_size(_fileName, error) };
+    return { time, error ? 0 : size };
+  }
+
+  /// Private method _waitChange
+  inline bool ReloadableProperties::_waitChange() {
+#ifdef __linux__
+    if (_inotify >= 0) {
+      std::string name{ std::filesystem::path(_fileName).filename().string() };
+      while (true) {
+        pollfd fds[2]{ { _inotify, POLLIN, 0 }, { _pipe[0], POLLIN, 0 } };
+        if (::poll(fds, 2, -1) < 0 && errno != EINTR)
+          return false;
+        if (fds[1].revents)
+          return false;
+
+        // Only the events of the file are changes. The events are aligned in the buffer
+        alignas(inotify_event) char events[4096];
+        bool changed{ false };
+        ssize_t length;
+        while ((length = ::read(_inotify, events, sizeof(events))) > 0) {
+          for (ssize_t pos = 0; pos < length; ) {
+            const inotify_event* event{ reinterpret_cast<const inotify_event*>(events + pos) };
+            if (event->len && name == event->name)
+              changed = true;
+            pos += ssize_t(sizeof(inotify_event) + event->len);
+          }
+        }
+        if (changed)
+          return true;
+      }
+    }
+#endif
+    std::unique_lock<std::mutex> lock(_mutex);
+    return !_wake.wait_for(lock, _interval, [this]() { return _stop; });
+  }
+
+  /// Private method _run
+  inline void ReloadableProperties::_run() {
+    auto stamp{ _stamp() };
+    while (_waitChange()) {
+      // Without inotify, the file is only reloaded if it has changed
+      if (_inotify < 0) {
+        auto current{ _stamp() };
+        if (current == stamp)
+          continue;
+        stamp = current;
+      }
+      reload();
+    }
+  }
+}
+
+#endif // RELOADABLE_PROPERTIES_H
@@ -0,0 +1,545 @@
+//  MIT License
+//
+//  Copyright (c) 2018 Francisco de Lanuza
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+#ifndef SIMD_TOKENIZER_H
+#define SIMD_TOKENIZER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FILE_READER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(FILE_READER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define FILE_READER_TARGET(isa) __attribute__((target(isa)))
+#else
+#define FILE_READER_TARGET(isa)
+#endif
+
+
+namespace utils
+{
+  /**
+    *  \brief Instruction sets supported by the SIMDTokenizer
+    */
+  enum class SIMDLevel {
+    SCALAR, ///< Portable byte by byte scan
+    SSE2,   ///< 16 bytes per iteration
+    AVX2    ///< 32 bytes per iteration
+  };
+
+  /**
+    *  \brief Tokens of one line, as found by the SIMDTokenizer
+    */
+  class Tokens
+  {
+  protected:
+    std::string_view _line;
+    const std::vector<size_t>& _separators;
+
+    /**
+      *  Values of the line if it contains quoted values, or nullptr
+      */
+    const std::vector<std::string_view>* _fields;
+
+  public:
+    Tokens(std::string_view line, const std::vector<size_t>& separators, const std::vector<std::string_view>* fields = nullptr)
+      : _line{ line }, _separators{ separators }, _fields{ fields } {}
+
+    /**
+      *  \brief Returns the whole line, without the end of line characters. A line with quoted values may span several lines of the text
+      *  @return  a view of the line
+      */
+    std::string_view line() const { return _line; }
+
+    /**
+      *  \brief Returns the number of tokens in the line
+      *  @return  the number of tokens
+      */
+    size_t size() const { return _separators.size() + 1; }
+
+    /**
+      *  \brief Returns the offsets of the separators in the line. Separators inside quoted values are not included
+      *  @return  the vector of offsets, relative to the start of the line
+      */
+    const std::vector<size_t>& separators() const { return _separators; }
+
+    /**
+      *  \brief Returns the token in the given position. Quoted values are returned without the enclosing quotes and with
+      *         their escaped quotes ("") unescaped
+      *  @param pos [in] token number, starting at 0
+      *  @return  a view of the token, valid until the next line is tokenized
+      */
+    std::string_view operator[](size_t pos) const {
+      if (_fields)
+        return (*_fields)[pos];
+      size_t first{ pos ? _separators[pos - 1] + 1 : 0 };
+      size_t last{ pos < _separators.size() ? _separators[pos] : _line.size() };
+      return _line.substr(first, last - first);
+    }
+  };
+
+
+  /**
+    *  \brief Incremental scanner finding where the records of a text end, following RFC 4180: a value starting with a quote
+    *         ends at the next single quote, and the separators and line breaks inside it are part of the value.
+    *         Two quotes inside a quoted value are an escaped quote. Quotes elsewhere are ordinary characters.
+    *         The text can be scanned in several pieces.
+    */
+  class RecordScanner
+  {
+  protected:
+    char _separator;
+    bool _quoted{ false };   ///< Inside a quoted value
+    bool _closing{ false };  ///< A quote has been found inside a quoted value. It is escaped if the next character is a quote too
+    bool _start{ true };     ///< At the start of a value
+
+  public:
+    explicit RecordScanner(char separator) : _separator{ separator } {}
+
+    /**
+      *  \brief Scans the next piece of the text, until a record ends. The scanner is reset when the record ends
+      *  @param text [in] Piece of the text, following the pieces already scanned
+      *  @return  the position of the line break ending the record, or npos if the record does not end in this piece
+      */
+    size_t scan(std::string_view text);
+
+    /**
+      *  \brief Indicates whether the scanner is inside a quoted value
+      *  @return  true if the last piece ended inside a quoted value, or just after its closing quote
+      */
+    bool quoted() const { return _quoted; }
+
+    /**
+      *  \brief Sets the scanner at the start of a record
+      */
+    void reset() { _quoted = _closing = false; _start = true; }
+  };
+
+
+  /**
+    *  \brief Vectorized tokenizer functor.
+    *         Finds the separators and line breaks of a text 16 (SSE2) or 32 (AVX2) bytes at a time. The instruction set is selected
+    *         at runtime, with a scalar fallback for other CPUs. The offsets of the separators are stored in reusable buffers,
+    *         so no memory is allocated once the buffers have grown to the size of the longest line.
+    *         Quoted values (RFC 4180) may contain separators, line breaks and escaped quotes. Quotes are found in the same
+    *         vectorized scan, so lines without quotes are split without any extra work.
+    */
+  class SIMDTokenizer
+  {
+  protected:
+    /**
+      *  Signature of the scan kernels: append to positions (base + offset) of every sep, '\n' or '"' in [data, data + size).
+      *  Return true if some '"' has been found
+      */
+    using Kernel = bool (*)(const char* data, size_t size, char sep, size_t base, std::vector<size_t>& positions);
+
+    /**
+      *  Size of the blocks scanned at once, to bound the size of _positions for big texts
+      */
+    static constexpr size_t BLOCK_SIZE{ 1 << 16 };
+
+    /**
+      *  Kernel used by this tokenizer
+      */
+    Kernel _kernel;
+
+    /**
+      *  Positions of the separators and line breaks in the current block
+      */
+    std::vector<size_t> _positions;
+
+    /**
+      *  Offsets of the separators in the current line
+      */
+    std::vector<size_t> _separators;
+
+    /**
+      *  Values of the current line, only used if it contains quoted values
+      */
+    std::vector<std::string_view> _fields;
+
+    /**
+      *  Quoted values of the current line with escaped quotes, once unescaped
+      */
+    std::string _unescaped;
+
+    static bool _scanScalar(const char* data, size_t size, char sep, size_t base, std::vector<size_t>& positions);
+#ifdef FILE_READER_X86
+    FILE_READER_TARGET("sse2") static bool _scanSSE2(const char* data, size_t size, char sep, size_t base, std::vector<size_t>& positions);
+    FILE_READER_TARGET("avx2") static bool _scanAVX2(const char* data, size_t size, char sep, size_t base, std::vector<size_t>& positions);
+#endif
+
+    static size_t _countScalar(const char* data, size_t size);
+#ifdef FILE_READER_X86
+    FILE_READER_TARGET("sse2") static size_t _countSSE2(const char* data, size_t size);
+    FILE_READER_TARGET("avx2") static size_t _countAVX2(const char* data, size_t size);
+#endif
+
+  public:
+    /**
+      *  \brief Constructor
+      *  @param level [in] Instruction set to be used. It is lowered to the best one supported by the CPU
+      */
+    explicit SIMDTokenizer(SIMDLevel level = SIMDLevel::AVX2);
+
+    /**
+      *  \brief Returns the best instruction set supported by the CPU
+      *  @return  the SIMD level
+      */
+    static SIMDLevel supported();
+
+    /**
+      *  \brief Returns the instruction set used by this tokenizer
+      *  @return  the SIMD level
+      */
+    SIMDLevel level() const;
+
+    /**
+      *  \brief Counts the lines of a text, 16 (SSE2) or 32 (AVX2) bytes at a time
+      *  @param text [in] text to be inspected
+      *  @param level [in] Instruction set to be used. It is lowered to the best one supported by the CPU
+      *  @return  the number of line breaks, plus one if the last line is not terminated by a line break
+      */
+    static size_t countLines(std::string_view text, SIMDLevel level = SIMDLevel::AVX2);
+
+    /**
+      *  \brief operator() --> splits a text in lines and each line in tokens
+      *  @param text [in] text to be tokenized. It can be a single line or a whole file
+      *  @param sep [in] token separator character
+      *  @param func [in] callable object receiving the Tokens of each line. Trailing '\r' characters are not part of the line
+      *  @return void
+      */
+    template<class FUNC>
+    void operator() (std::string_view text, const char sep, FUNC&& func);
+
+  protected:
+    /**
+      *  \brief Fills _fields with the values of a line containing quoted values
+      *  @param line [in] the line
+      */
+    void _quotedFields(std::string_view line);
+  };
+
+
+  //*** DEFINITIONS ***********************************************************************************************************/
+  //***************************************************************************************************************************/
+
+  /// SCAN KERNELS
+  inline bool SIMDTokenizer::_scanScalar(const char* data, size_t size, char sep, size_t base, std::vector<size_t>& positions) {
+    bool quotes{ false };
+    for (size_t i = 0; i < size; ++i) {
+      if (data[i] == sep || data[i] == '\n' || data[i] == '"') {
+        positions.push_back(base + i);
+        quotes = quotes || data[i] == '"';
+      }
+    }
+    return quotes;
+  }
+
+#ifdef FILE_READER_X86
+  /// Position of the lowest bit set
+  inline unsigned lowestBit(uint32_t mask) {
+#ifdef _MSC_VER
+    unsigned long pos;
+    _BitScanForward(&pos, mask);
+    return unsigned(pos);
+#else
+    return unsigned(__builtin_ctz(mask));
+#endif
+  }
+
+  FILE_READER_TARGET("sse2") inline bool SIMDTokenizer::_scanSSE2(const char* data, size_t size, char sep, size_t base, std::vector<size_t>& positions) {
+    const __m128i vsep{ _mm_set1_epi8(sep) };
+    const __m128i veol{ _mm_set1_epi8('\n') };
+    const __m128i vquote{ _mm_set1_epi8('"') };
+    __m128i quotes{ _mm_setzero_si128() };
+    size_t i{ 0 };
+    for (; i + 16 <= size; i += 16) {
+      __m128i chunk{ _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)) };
+      __m128i quote{ _mm_cmpeq_epi8(chunk, vquote) };
+      quotes = _mm_or_si128(quotes, quote);
+      uint32_t mask{ uint32_t(_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, vsep), _mm_cmpeq_epi8(chunk, veol)), quote))) };
+      while (mask) {
+        positions.push_back(base + i + lowestBit(mask));
+        mask &= mask - 1;
+      }
+    }
+    bool tail{ _scanScalar(data + i, size - i, sep, base + i, positions) };
+    return tail || _mm_movemask_epi8(quotes) != 0;
+  }
+
+  FILE_READER_TARGET("avx2") inline bool SIMDTokenizer::_scanAVX2(const char* data, size_t size, char sep, size_t base, std::vector<size_t>& positions) {
+    const __m256i vsep{ _mm256_set1_epi8(sep) };
+    const __m256i veol{ _mm256_set1_epi8('\n') };
+    const __m256i vquote{ _mm256_set1_epi8('"') };
+    __m256i quotes{ _mm256_setzero_si256() };
+    size_t i{ 0 };
+    for (; i + 32 <= size; i += 32) {
+      __m256i chunk{ _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)) };
+      __m256i quote{ _mm256_cmpeq_epi8(chunk, vquote) };
+      quotes = _mm256_or_si256(quotes, quote);
+      uint32_t mask{ uint32_t(_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, vsep), _mm256_cmpeq_epi8(chunk, veol)), quote))) };
+      while (mask) {
+        positions.push_back(base + i + lowestBit(mask));
+        mask &= mask - 1;
+      }
+    }
+    bool tail{ _scanSSE2(data + i, size - i, sep, base + i, positions) };
+    return tail || _mm256_movemask_epi8(quotes) != 0;
+  }
+#endif
+
+  /// COUNT KERNELS
+  inline size_t SIMDTokenizer::_countScalar(const char* data, size_t size) {
+    return size_t(std::count(data, data + size, '\n'));
+  }
+
+#ifdef FILE_READER_X86
+  FILE_READER_TARGET("sse2") inline size_t SIMDTokenizer::_countSSE2(const char* data, size_t size) {
+    const __m128i veol{ _mm_set1_epi8('\n') };
+    size_t count{ 0 };
+    size_t i{ 0 };
+    while (i + 16 <= size) {
+      // Each byte of the accumulator counts up to 255 line breaks, then they are added horizontally
+      __m128i acc{ _mm_setzero_si128() };
+      size_t end{ i + std::min((size - i) / 16, size_t(255)) * 16 };
+      for (; i < end; i += 16)
+        acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), veol));
+      alignas(16) uint64_t sums[2];
+      _mm_store_si128(reinterpret_cast<__m128i*>(sums), _mm_sad_epu8(acc, _mm_setzero_si128()));
+      count += size_t(sums[0] + sums[1]);
+    }
+    return count + _countScalar(data + i, size - i);
+  }
+
+  FILE_READER_TARGET("avx2") inline size_t SIMDTokenizer::_countAVX2(const char* data, size_t size) {
+    const __m256i veol{ _mm256_set1_epi8('\n') };
+    size_t count{ 0 };
+    size_t i{ 0 };
+    while (i + 32 <= size) {
+      // Each byte of the accumulator counts up to 255 line breaks, then they are added horizontally
+      __m256i acc{ _mm256_setzero_si256() };
+      size_t end{ i + std::min((size - i) / 32, size_t(255)) * 32 };
+      for (; i < end; i += 32)
+        acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), veol));
+      alignas(32) uint64_t sums[4];
+      _mm256_store_si256(reinterpret_cast<__m256i*>(sums), _mm256_sad_epu8(acc, _mm256_setzero_si256()));
+      count += size_t(sums[0] + sums[1] + sums[2] + sums[3]);
+    }
+    return count + _countSSE2(data + i, size - i);
+  }
+#endif
+
+  /// COUNT LINES
+  inline size_t SIMDTokenizer::countLines(std::string_view text, SIMDLevel level) {
+    size_t count;
+#ifdef FILE_READER_X86
+    level = std::min(level, supported());
+    if (level == SIMDLevel::AVX2) count = _countAVX2(text.data(), text.size());
+    else if (level == SIMDLevel::SSE2) count = _countSSE2(text.data(), text.size());
+    else count = _countScalar(text.data(), text.size());
+#else
+    (void)level;
+    count = _countScalar(text.data(), text.size());
+#endif
+    // Last line, not terminated by a line break
+    if (!text.empty() && text.back() != '\n')
+      ++count;
+    return count;
+  }
+
+  /// SUPPORTED INSTRUCTION SET
+  inline SIMDLevel SIMDTokenizer::supported() {
+    static const SIMDLevel level = []() {
+#if defined(FILE_READER_X86) && defined(_MSC_VER)
+      int info[4];
+      __cpuid(info, 0);
+      int maxLeaf{ info[0] };
+      __cpuid(info, 1);
+      bool sse2{ (info[3] & (1 << 26)) != 0 };
+      bool osxsave{ (info[2] & (1 << 27)) != 0 };
+      bool avx2{ false };
+      if (maxLeaf >= 7 && osxsave && (_xgetbv(0) & 0x6) == 0x6) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+      }
+      return avx2 ? SIMDLevel::AVX2 : sse2 ? SIMDLevel::SSE2 : SIMDLevel::SCALAR;
+#elif defined(FILE_READER_X86)
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2") ? SIMDLevel::AVX2 : __builtin_cpu_supports("sse2") ? SIMDLevel::SSE2 : SIMDLevel::SCALAR;
+#else
+      return SIMDLevel::SCALAR;
+#endif
+    }();
+    return level;
+  }
+
+  /// CONSTRUCTOR
+  inline SIMDTokenizer::SIMDTokenizer(SIMDLevel level) : _kernel{ _scanScalar } {
+#ifdef FILE_READER_X86
+    level = std::min(level, supported());
+    if (level == SIMDLevel::AVX2) _kernel = _scanAVX2;
+    else if (level == SIMDLevel::SSE2) _kernel = _scanSSE2;
+#else
+    (void)level;
+#endif
+  }
+
+  inline SIMDLevel SIMDTokenizer::level() const {
+#ifdef FILE_READER_X86
+    if (_kernel == _scanAVX2) return SIMDLevel::AVX2;
+    if (_kernel == _scanSSE2) return SIMDLevel::SSE2;
+#endif
+    return SIMDLevel::SCALAR;
+  }
+
+  /// RECORD SCANNER
+  inline size_t RecordScanner::scan(std::string_view text) {
+    for (size_t i = 0; i < text.size(); ++i) {
+      char c{ text[i] };
+      if (_closing) {
+        _closing = false;
+        if (c == '"') continue;
+        _quoted = false;
+      }
+      if (_quoted) {
+        if (c == '"') _closing = true;
+        continue;
+      }
+      if (c == '\n') {
+        reset();
+        return i;
+      }
+      if (c == _separator)
+        _start = true;
+      else {
+        if (c == '"' && _start) _quoted = true;
+        _start = false;
+      }
+    }
+    return std::string_view::npos;
+  }
+
+  /// Protected method _quotedFields
+  inline void SIMDTokenizer::_quotedFields(std::string_view line) {
+    _fields.clear();
+    _unescaped.clear();
+    // Reserved up front, so the views of the unescaped values are not invalidated
+    _unescaped.reserve(line.size());
+
+    size_t first{ 0 };
+    for (size_t i = 0; i <= _separators.size(); ++i) {
+      size_t last{ i < _separators.size() ? _separators[i] : line.size() };
+      std::string_view value{ line.substr(first, last - first) };
+      first = last + 1;
+
+      if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+        value = value.substr(1, value.size() - 2);
+        if (value.find('"') != std::string_view::npos) {
+          size_t start{ _unescaped.size() };
+          for (size_t j = 0; j < value.size(); ++j) {
+            _unescaped += value[j];
+            if (value[j] == '"' && j + 1 < value.size() && value[j + 1] == '"') ++j;
+          }
+          value = std::string_view(_unescaped.data() + start, _unescaped.size() - start);
+        }
+      }
+      _fields.push_back(value);
+    }
+  }
+
+  /// TOKENIZER FUNCTOR
+  template<class FUNC>
+  void SIMDTokenizer::operator() (std::string_view text, const char sep, FUNC&& func) {
+    const char* data{ text.data() };
+    size_t lineStart{ 0 };
+    bool quoted{ false };      // Inside a quoted value
+    bool quotedLine{ false };  // The current line contains quoted values
+    size_t escaped{ std::string_view::npos };
+    _separators.clear();
+
+    auto endLine = [&](size_t lineEnd) {
+      // Discard the carriage return of Windows line endings
+      size_t last{ (lineEnd > lineStart && data[lineEnd - 1] == '\r') ? lineEnd - 1 : lineEnd };
+      std::string_view line(data + lineStart, last - lineStart);
+      if (quotedLine) {
+        _quotedFields(line);
+        func(Tokens(line, _separators, &_fields));
+      }
+      else
+        func(Tokens(line, _separators));
+      _separators.clear();
+      lineStart = lineEnd + 1;
+      quotedLine = false;
+    };
+
+    for (size_t block = 0; block < text.size(); block += BLOCK_SIZE) {
+      _positions.clear();
+      bool quotes{ _kernel(data + block, std::min(BLOCK_SIZE, text.size() - block), sep, block, _positions) };
+
+      // Fast path: blocks without quotes, outside quoted values
+      if (!quotes && !quoted) {
+        for (size_t pos : _positions) {
+          if (data[pos] == '\n')
+            endLine(pos);
+          else
+            _separators.push_back(pos - lineStart);
+        }
+        continue;
+      }
+
+      for (size_t pos : _positions) {
+        char c{ data[pos] };
+        if (c == '"') {
+          // Quotes only open a quoted value at its start. Inside it, two quotes are an escaped quote
+          if (quoted) {
+            if (pos == escaped) continue;
+            if (pos + 1 < text.size() && data[pos + 1] == '"') escaped = pos + 1;
+            else quoted = false;
+          }
+          else if (pos == lineStart + (_separators.empty() ? 0 : _separators.back() + 1))
+            quoted = quotedLine = true;
+        }
+        else if (quoted)
+          continue;
+        else if (c == '\n')
+          endLine(pos);
+        else
+          _separators.push_back(pos - lineStart);
+      }
+    }
+    // Last line, not terminated by a line break
+    if (lineStart < text.size() || text.empty())
+      endLine(text.size());
+  }
+}
+
+#endif // SIMD_TOKENIZER_H
@@ -0,0 +1,112 @@
+//  MIT License
+//
+//  Copyright (c) 2018 Francisco de Lanuza
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+
+#ifndef STRING_CONVERTER_H
+#define STRING_CONVERTER_H
+
+#include <string>
+#include <memory_resource>
+#include <string_view>
+#include <type_traits>
+#include <charconv>
+#include <system_error>
+
+
+namespace utils
+{
+  /**
+    *  \brief Indicates whether values of type TYPE can be read by fromString
+    */
+  template<class TYPE>
+  struct is_convertible_value : std::integral_constant<bool, std::is_arithmetic<TYPE>::value || std::is_same<TYPE, std::string>::value || std::is_same<TYPE, std::pmr::string>::value> {};
+
+  /**
+    *  \brief Removes the leading and trailing blanks (spaces and tabs) of a text
+    *  @param text [in] text to be trimmed
+    *  @return  a view of the text without the blanks
+    */
+  std::string_view trimBlanks(std::string_view text);
+
+  /**
+    *  \brief Converts a range of characters to a value of type TYPE.
+    *         Numbers are parsed with std::from_chars, so the conversion does not depend on the locale.
+    *         Leading and trailing blanks are ignored, and the rest of the text must be a valid value: no garbage is accepted.
+    *         Booleans are "true", "false" (case insensitive), "1" or "0".
+    *  @param text [in] text to be converted
+    *  @param value [out] converted value. Not modified if the conversion fails
+    *  @return  false if the text is not a valid TYPE, or it is out of its range
+    */
+  template<class TYPE>
+  bool fromString(std::string_view text, TYPE& value);
+
+
+  //*** DEFINITIONS ***********************************************************************************************************/
+  //***************************************************************************************************************************/
+
+  /// TRIM BLANKS
+  inline std::string_view trimBlanks(std::string_view text) {
+    size_t first{ text.find_first_not_of(" \t") };
+    if (first == std::string_view::npos)
+      return text.substr(0, 0);
+    return text.substr(first, text.find_last_not_of(" \t") - first + 1);
+  }
+
+  /// FROM STRING
+  template<class TYPE>
+  bool fromString(std::string_view text, TYPE& value) {
+    static_assert(is_convertible_value<TYPE>::value, "Type not supported ");
+
+    if constexpr (std::is_same<TYPE, std::string>::value || std::is_same<TYPE, std::pmr::string>::value) {
+      value.assign(text);
+      return true;
+    }
+    else if constexpr (std::is_same<TYPE, bool>::value) {
+      text = trimBlanks(text);
+      auto equals = [text](std::string_view word) {
+        if (text.size() != word.size()) return false;
+        for (size_t i = 0; i < text.size(); ++i)
+          if ((text[i] | 0x20) != word[i]) return false;
+        return true;
+      };
+      if (text == "1" || equals("true")) value = true;
+      else if (text == "0" || equals("false")) value = false;
+      else return false;
+      return true;
+    }
+    else {
+      text = trimBlanks(text);
+      // std::from_chars does not accept an explicit '+' sign
+      if (text.size() > 1 && text[0] == '+' && text[1] != '-')
+        text.remove_prefix(1);
+
+      const char* end{ text.data() + text.size() };
+      TYPE result;
+      auto [ptr, ec] = std::from_chars(text.data(), end, result);
+      if (ec != std::errc() || ptr != end || text.empty())
+        return false;
+      value = result;
+      return true;
+    }
+  }
+}
+
+#endif // STRING_CONVERTER_H
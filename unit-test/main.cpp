@@ -1,7 +1,79 @@
 #include <properties_file_reader.h>
 #include <csv_file_reader.h>
+#include <csv_stream.h>
+#include <csv_column_reader.h>
+#include <csv_indexed_reader.h>
+#include <csv_follower.h>
+#include <csv_multi_reader.h>
+#include <reloadable_properties.h>
 
 #include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory_resource>
+#include <fstream>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <chrono>
+
+// Every heap allocation of the test is counted. All the forms of new and delete are replaced, so they are always paired
+static std::atomic<size_t> allocations{ 0 };
+
+// Kept out of line, so the compiler does not see operator new paired with free
+#ifdef _MSC_VER
+#define TEST_NOINLINE __declspec(noinline)
+#else
+#define TEST_NOINLINE __attribute__((noinline))
+#endif
+
+// The start of the block allocated is stored before the aligned pointer returned
+TEST_NOINLINE void* countedAllocate(std::size_t size, std::size_t alignment) noexcept {
+  ++allocations;
+  alignment = std::max(alignment, alignof(void*));
+  void* raw{ std::malloc(size + alignment + sizeof(void*)) };
+  if (!raw)
+    return nullptr;
+  std::uintptr_t aligned{ (std::uintptr_t(raw) + sizeof(void*) + alignment - 1) & ~std::uintptr_t(alignment - 1) };
+  reinterpret_cast<void**>(aligned)[-1] = raw;
+  return reinterpret_cast<void*>(aligned);
+}
+
+TEST_NOINLINE void countedRelease(void* ptr) noexcept {
+  if (ptr)
+    std::free(static_cast<void**>(ptr)[-1]);
+}
+
+void* countedNew(std::size_t size, std::size_t alignment) {
+  if (void* ptr = countedAllocate(size, alignment))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size) { return countedNew(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new[](std::size_t size) { return countedNew(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return countedNew(size, std::size_t(alignment)); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return countedNew(size, std::size_t(alignment)); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return countedAllocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return countedAllocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return countedAllocate(size, std::size_t(alignment)); }
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return countedAllocate(size, std::size_t(alignment)); }
+
+void operator delete(void* ptr) noexcept { countedRelease(ptr); }
+void operator delete[](void* ptr) noexcept { countedRelease(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { countedRelease(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { countedRelease(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { countedRelease(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { countedRelease(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { countedRelease(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { countedRelease(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { countedRelease(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { countedRelease(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { countedRelease(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { countedRelease(ptr); }
 
 int main() {
   using namespace utils;
@@ -32,10 +104,31 @@ int main() {
   double rf = fr.value<double>("key3");
   std::cout << rf << std::endl;
 
-  long rfl = fr.value<long>("key3");
-  std::cout << rfl << std::endl;
+  try {
+    long rfl = fr.value<long>("key3");
+    std::cout << rfl << std::endl;
+  }
+  catch (std::exception& e) {
+    std::cout << e.what() << std::endl;
+  }
+
+  long rfi = fr.value<long>("key");
+  std::cout << rfi << std::endl;
 
 
+  // TEST CONVERSIONS
+  {
+    int64_t i64{ 0 };
+    unsigned u{ 0 };
+    bool b{ false };
+    double d{ 0 };
+    std::cout << fromString(" -9223372036854775808 ", i64) << " " << i64 << std::endl;
+    std::cout << fromString("+4294967295", u) << " " << u << std::endl;
+    std::cout << fromString("-1", u) << " " << fromString("4294967296", u) << " " << fromString("12abc", u) << " " << fromString("", u) << " " << u << std::endl;
+    std::cout << fromString("TRUE", b) << " " << b << " " << fromString("0", b) << " " << b << " " << fromString("yes", b) << std::endl;
+    std::cout << fromString("1e-3", d) << " " << d << " " << fromString("1,5", d) << std::endl;
+  }
+
   // TEST CSV FILES
   {
     try {
@@ -92,4 +185,973 @@ int main() {
   catch (std::exception& e) {
     std::cout << e.what();
   }
-}
\ No newline at end of file
+
+  // TEST INPUT BACKENDS
+  {
+    CSVFileReader<int, std::string, double, std::string> mapped("test.csv", ';', CSVInput::MAPPED);
+    CSVFileReader<int, std::string, double, std::string> stream("test.csv", ';', CSVInput::STREAM);
+    std::cout << std::endl << "Mapped and stream inputs match: " << (mapped.size() == stream.size() && std::equal(mapped.begin(), mapped.end(), stream.begin())) << std::endl;
+
+    FileBuffer buffer("test.csv");
+    std::cout << "test.csv mapped: " << buffer.mapped() << ", " << buffer.size() << " bytes" << std::endl;
+  }
+
+  // TEST STRING_VIEW RECORDS
+  {
+    CSVView csv("test.csv", ';');
+
+    for (auto& rec : csv) {
+      for (auto& val : rec)
+        std::cout << val << " ";
+      std::cout << std::endl;
+    }
+
+    std::cout << csv.size() << "x" << csv.cols() << " " << csv[4][3] << std::endl;
+
+    try {
+      CSVView csv2("test-wrong.csv", '#', 4);
+    }
+    catch (std::exception& e) {
+      std::cout << e.what() << std::endl;
+    }
+  }
+
+  // TEST SIMD TOKENIZER
+  {
+    std::string text;
+    for (int i = 0; i < 500; ++i)
+      text += std::to_string(i) + ";" + std::string(size_t(i % 37), 'x') + ";;" + std::to_string(i * 0.5) + (i % 3 ? "\n" : "\r\n");
+
+    auto tokenize = [&text](SIMDLevel level) {
+      std::vector<std::string> result;
+      SIMDTokenizer tokenizer(level);
+      tokenizer(text, ';', [&result](const Tokens& tokens) {
+        for (size_t i = 0; i < tokens.size(); ++i)
+          result.emplace_back(tokens[i]);
+        result.emplace_back("\n");
+      });
+      return result;
+    };
+
+    std::vector<std::string> expected;
+    Tokenizer tokenizer;
+    std::vector<std::string> tokens;
+    size_t pos{ 0 }, eol;
+    while ((eol = text.find('\n', pos)) != std::string::npos) {
+      std::string line{ text.substr(pos, eol - pos) };
+      if (line.back() == '\r') line.pop_back();
+      tokenizer(tokens, line, ';');
+      expected.insert(expected.end(), tokens.begin(), tokens.end());
+      expected.emplace_back("\n");
+      pos = eol + 1;
+    }
+
+    std::cout << "SIMD level: " << int(SIMDTokenizer::supported()) << std::endl;
+    std::cout << "Scalar tokenizer matches: " << (tokenize(SIMDLevel::SCALAR) == expected) << std::endl;
+    std::cout << "SSE2 tokenizer matches: " << (tokenize(SIMDLevel::SSE2) == expected) << std::endl;
+    std::cout << "AVX2 tokenizer matches: " << (tokenize(SIMDLevel::AVX2) == expected) << std::endl;
+  }
+
+  // TEST PARALLEL PARSING
+  {
+    CSVFileReader<int, std::string, double, std::string> csv("test.csv", ';');
+    CSVFileReader<int, std::string, double, std::string> csv4("test.csv", ';', CSVInput::MAPPED, 4);
+    std::cout << "Parallel typed records match: " << (csv.size() == csv4.size() && std::equal(csv.begin(), csv.end(), csv4.begin())) << std::endl;
+
+    CSVFileReaderStr str("test.csv", ';');
+    CSVFileReaderStr str4("test.csv", ';', 0, CSVInput::MAPPED, 4);
+    std::cout << "Parallel string records match: " << (str.size() == str4.size() && std::equal(str.begin(), str.end(), str4.begin())) << std::endl;
+
+    CSVView view4("test.csv", ';', 0, 4);
+    std::cout << "Parallel view records: " << view4.size() << " " << view4[4][3] << std::endl;
+
+    try {
+      CSVFileReaderStr csv2("test-wrong.csv", '#', 4, CSVInput::MAPPED, 4);
+    }
+    catch (std::exception& e) {
+      std::cout << e.what() << std::endl;
+    }
+    try {
+      CSVView csv2("test-wrong.csv", '#', 0, 4);
+    }
+    catch (std::exception& e) {
+      std::cout << e.what() << std::endl;
+    }
+  }
+
+  // TEST STREAMING
+  {
+    CSVFileReader<int, std::string, double, std::string> csv("test.csv", ';');
+    CSVStream<int, std::string, double, std::string> stream("test.csv", ';', 8);
+    size_t row{ 0 };
+    bool match{ true };
+    for (auto& rec : stream)
+      match = match && row < csv.size() && rec == csv[row++];
+    std::cout << "Streamed records match: " << (match && stream.count() == csv.size()) << std::endl;
+
+    try {
+      CSVStream<std::string, std::string, std::string, std::string> wrong("test-wrong.csv", '#');
+      while (wrong.next());
+    }
+    catch (std::exception& e) {
+      std::cout << e.what() << std::endl;
+    }
+  }
+
+  // TEST COLUMNAR STORAGE
+  {
+    CSVFileReader<int, std::string, double, std::string> csv("test.csv", ';');
+    CSVColumnReader<int, std::string, double, std::string> columns("test.csv", ';');
+    CSVColumnReader<int, std::string, double, std::string> columns4("test.csv", ';', CSVInput::MAPPED, 4);
+
+    bool match{ columns.size() == csv.size() && columns4.size() == csv.size() };
+    for (size_t i = 0; match && i < csv.size(); ++i)
+      match = columns.column<0>()[i] == std::get<0>(csv[i]) && columns.column<2>()[i] == std::get<2>(csv[i]) && columns4.column<3>()[i] == std::get<3>(csv[i]);
+    std::cout << "Columnar records match: " << match << std::endl;
+
+    double sum{ 0 };
+    for (double d : columns.column<2>()) sum += d;
+    std::cout << "Sum of column 2: " << sum << std::endl;
+  }
+
+  // TEST COLUMN SELECTION
+  {
+    CSVFileReader<std::string, int> csv("test.csv", ';', { 3, 0 });
+    for (auto& [str, i] : csv)
+      std::cout << str << " " << i << " | ";
+    std::cout << std::endl;
+
+    CSVFileReader<double> dbl("test.csv", ';', CSVSelection{ 2 }, CSVInput::MAPPED, 4);
+    std::cout << dbl.size() << "x" << dbl.cols() << " " << dbl[4][0] << std::endl;
+
+    try {
+      CSVFileReaderStr wrong("test.csv", ';', { 1, 4 }, CSVInput::STREAM);
+    }
+    catch (std::exception& e) {
+      std::cout << e.what() << std::endl;
+    }
+    try {
+      CSVFileReader<int, int> wrong("test.csv", ';', { 1 });
+    }
+    catch (std::exception& e) {
+      std::cout << e.what() << std::endl;
+    }
+  }
+
+  // TEST ROW FILTER
+  {
+    CSVOptions options;
+    options.separator = ';';
+    options.filter = filterColumn(0, [](std::string_view id) { return id == "2"; });
+    CSVFileReader<int, std::string, double, std::string> csv("test.csv", options);
+    for (auto& rec : csv)
+      std::cout << std::get<2>(rec) << " ";
+    std::cout << std::endl;
+
+    // Rejected records are not converted, so their values may be invalid
+    options.filter = [](const Tokens& tokens) { return tokens[2].front() != '3'; };
+    options.selection = CSVSelection{ 2 };
+    options.threads = 4;
+    CSVFileReader<double> dbl("test.csv", options);
+    std::cout << dbl.size() << "x" << dbl.cols() << " " << dbl[dbl.size() - 1][0] << std::endl;
+
+    options.input = CSVInput::STREAM;
+    CSVFileReaderStr str("test.csv", options);
+    std::cout << str.size() << " " << str[0][0] << std::endl;
+
+    try {
+      CSVOptions wrong;
+      wrong.separator = '#';
+      wrong.filter = filterColumn(0, [](std::string_view id) { return id == "1"; });
+      CSVFileReaderStr csvw("test-wrong.csv", wrong);
+    }
+    catch (std::exception& e) {
+      std::cout << e.what() << std::endl;
+    }
+  }
+
+  // TEST BINARY CACHE
+  {
+    CSVOptions options(';');
+    options.cache = "test.csv.cache";
+    std::remove(options.cache.c_str());
+
+    CSVFileReader<int, std::string, double, std::string> parsed("test.csv", options);
+    CSVFileReader<int, std::string, double, std::string> cached("test.csv", options);
+    std::cout << std::boolalpha << std::filesystem::exists(options.cache) << " " << cached.size() << " "
+              << std::equal(parsed.begin(), parsed.end(), cached.begin(), cached.end()) << std::endl;
+
+    CacheKey key;
+    cacheKey("test.csv", typeSignature<int, std::string, double, std::string>() + ';', key);
+    std::vector<std::tuple<int, std::string, double, std::string>> records;
+    std::cout << readCache(options.cache, key, records) << " " << records.size() << " " << typeSignature<int, std::string, double, std::string>() << std::endl;
+
+    // A cache built for other types, options or source file is discarded
+    std::vector<std::tuple<int, std::string, float, std::string>> other;
+    key.schema = typeSignature<int, std::string, float, std::string>() + ';';
+    std::cout << readCache(options.cache, key, other) << " ";
+    key.mtime += 1;
+    std::cout << readCache(options.cache, key, records) << std::endl;
+
+    options.selection = CSVSelection{ 2, 0 };
+    CSVFileReader<double, int> selected("test.csv", options);
+    std::cout << std::get<0>(selected[0]) << " " << std::get<1>(selected[0]) << std::endl;
+    std::remove(options.cache.c_str());
+
+    // A bool byte other than 0 or 1 is rejected, and no temporary file is left behind
+    key.schema = typeSignature<bool>();
+    std::vector<std::tuple<bool>> flags{ { true }, { false } };
+    std::cout << writeCache(options.cache, key, flags) << " ";
+    {
+      std::fstream file(options.cache, std::ios::in | std::ios::out | std::ios::binary);
+      file.seekp(-1, std::ios::end);
+      file.put(char(2));
+    }
+    std::vector<std::tuple<bool>> read;
+    size_t temporary{ 0 };
+    for (const auto& entry : std::filesystem::directory_iterator("."))
+      temporary += entry.path().extension() == ".tmp";
+    std::cout << readCache(options.cache, key, read) << " " << read.size() << " " << temporary << " "
+              << writeCache("missing-directory/test.csv.cache", key, flags) << std::endl;
+    std::remove(options.cache.c_str());
+
+    // A valid cache is read without opening the source, so a compressed file is not decompressed, and it restores the header
+    CSVOptions named;
+    named.header = true;
+    named.names = { "price", "id" };
+    named.cache = "test-header.csv.gz.cache";
+    cacheKey("test-header.csv.gz", typeSignature<double, int>() + ", h n5:price n2:id", key);
+    std::vector<std::tuple<double, int>> prices{ { 9.5, 7 } };
+    writeCache(named.cache, key, prices, { "id", "name", "price" });
+    CSVFileReader<double, int> fromCache("test-header.csv.gz", named);
+    std::cout << fromCache.size() << " " << std::get<0>(fromCache[0]) << " " << std::get<1>(fromCache[0]) << " "
+              << fromCache.header()[0] << " " << fromCache.header()[1] << std::noboolalpha << std::endl;
+    std::remove(named.cache.c_str());
+
+    // A cache which cannot be read is a miss, so the file is parsed
+    options.selection.reset();
+    options.cache = "test-locked.cache";
+    std::ofstream(options.cache) << "locked";
+    std::filesystem::permissions(options.cache, std::filesystem::perms::none);
+    CSVFileReader<int, std::string, double, std::string> locked("test.csv", options);
+    std::cout << (locked.size() == parsed.size()) << std::noboolalpha << std::endl;
+    std::remove(options.cache.c_str());
+  }
+
+  // TEST ARENA STRINGS
+  {
+    CSVFileReader<int, std::pmr::string, double, std::pmr::string> csv("test.csv", ';', CSVInput::MAPPED, 4);
+    CSVFileReader<std::pmr::string> str("test.csv", ';', 0, CSVInput::STREAM);
+    bool arena{ true };
+    for (auto& [i, s1, d, s2] : csv) {
+      std::cout << i << " " << s1 << " " << d << " " << s2 << " | ";
+      arena = arena && s2.get_allocator().resource() != std::pmr::get_default_resource();
+    }
+    std::cout << std::endl;
+    for (auto& rec : str) {
+      std::cout << rec[3] << " ";
+      arena = arena && rec[3].get_allocator().resource() == rec.get_allocator().resource() && rec.get_allocator().resource() != std::pmr::get_default_resource();
+    }
+    std::cout << std::endl << "arena " << arena << std::endl;
+
+    // Copies of the records are independent of the arenas of the reader
+    std::pmr::string copy;
+    {
+      CSVFileReader<int, std::pmr::string, double, std::pmr::string> other(csv);
+      copy = std::get<3>(other[4]) + " is a string longer than the small buffer";
+    }
+    std::cout << copy << std::endl;
+  }
+
+  // TEST ALLOCATIONS PER LINE
+  {
+    // Allocations made while loading a file of numeric records
+    auto count = [](size_t lines, auto load) {
+      {
+        std::ofstream file("test-alloc.csv", std::ios::out | std::ios::binary);
+        for (size_t i = 0; i < lines; ++i)
+          file << i << ";" << i * 0.5 << ";" << i * 3 << "\n";
+      }
+      size_t before{ allocations };
+      load();
+      size_t result{ allocations - before };
+      std::remove("test-alloc.csv");
+      return result;
+    };
+
+    // Loading 10 times more lines must not make more allocations, apart from the growth of the vector of records
+    for (CSVInput input : { CSVInput::MAPPED, CSVInput::STREAM }) {
+      auto load = [input]() { CSVFileReader<int, double, long> csv("test-alloc.csv", ';', input); };
+      size_t small{ count(10000, load) };
+      size_t big{ count(100000, load) };
+      std::cout << "Allocations " << (input == CSVInput::MAPPED ? "MAPPED" : "STREAM") << ": " << (big - small <= 8 ? "constant" : "per line") << std::endl;
+      if (big - small > 8) {
+        std::cerr << "FAILED: " << big - small << " more allocations for 10 times more lines" << std::endl;
+        return 1;
+      }
+    }
+
+    // The old tokenizer reuses the token strings
+    Tokenizer tokenizer;
+    std::vector<std::string> tokens;
+    tokenizer(tokens, "a long first token;another long token;3", ';');
+    size_t before{ allocations };
+    for (int i = 0; i < 1000; ++i)
+      tokenizer(tokens, "a long first value;another long value;4", ';');
+    std::cout << "Tokenizer allocations: " << allocations - before << std::endl;
+
+    // Streaming needs no allocation once the first record has been read
+    {
+      std::ofstream file("test-alloc.csv", std::ios::out | std::ios::binary);
+      for (size_t i = 0; i < 100000; ++i)
+        file << i << ";" << i * 0.5 << ";" << i * 3 << "\n";
+    }
+    {
+      CSVStream<int, double, long> stream("test-alloc.csv", ';');
+      stream.next();
+      before = allocations;
+      while (stream.next());
+      std::cout << "CSVStream allocations: " << allocations - before << " for " << stream.count() << " records" << std::endl;
+    }
+    std::remove("test-alloc.csv");
+  }
+
+  // TEST LINE COUNT PRESCAN
+  {
+    std::string text;
+    for (size_t i = 0; i < 5000; ++i)
+      text += std::string(i % 97, 'x') + (i % 3 ? "\n" : "\r\n");
+    for (SIMDLevel level : { SIMDLevel::SCALAR, SIMDLevel::SSE2, SIMDLevel::AVX2 })
+      std::cout << SIMDTokenizer::countLines(text, level) << " " << SIMDTokenizer::countLines(text + "last", level) << " | ";
+    std::cout << SIMDTokenizer::countLines("") << " " << SIMDTokenizer::countLines("\n") << std::endl;
+
+    // With the prescan, the vector of records is allocated once, whatever the size of the file
+    auto load = [](size_t lines, bool prescan) {
+      {
+        std::ofstream file("test-alloc.csv", std::ios::out | std::ios::binary);
+        for (size_t i = 0; i < lines; ++i)
+          file << i << ";" << i * 0.5 << ";" << i * 3 << "\n";
+      }
+      CSVOptions options(';');
+      options.prescan = prescan;
+      size_t before{ allocations };
+      CSVFileReader<int, double, long> csv("test-alloc.csv", options);
+      size_t result{ allocations - before };
+      std::remove("test-alloc.csv");
+      return result;
+    };
+    std::cout << "Prescan allocations: " << load(1000, true) << " " << load(100000, true) << ", without prescan: " << load(1000, false) << " " << load(100000, false) << std::endl;
+  }
+
+  // TEST QUOTED VALUES
+  {
+    auto print = [](auto&& csv) {
+      for (auto& [i, name, text, d] : csv)
+        std::cout << i << " [" << name << "] [" << text << "] " << d << " | ";
+      std::cout << std::endl;
+    };
+    print(CSVFileReader<int, std::string, std::string, double>("test-quoted.csv"));
+    print(CSVFileReader<int, std::string, std::string, double>("test-quoted.csv", ',', CSVInput::MAPPED, 3));
+    print(CSVFileReader<int, std::string, std::string, double>("test-quoted.csv", ',', CSVInput::STREAM));
+    print(CSVStream<int, std::string, std::string, double>("test-quoted.csv", ',', 8));
+
+    CSVFileReaderStr str("test-quoted.csv");
+    std::cout << str.size() << "x" << str.cols() << " [" << str[1][2] << "]" << std::endl;
+
+    CSVView view("test-quoted.csv");
+    for (auto& rec : view)
+      std::cout << "[" << rec[1] << "] [" << rec[2] << "] ";
+    std::cout << std::endl;
+
+    CSVColumnReader<int, std::string, std::string, double> columns("test-quoted.csv", ',', CSVInput::MAPPED, 2);
+    for (auto& text : columns.column<2>())
+      std::cout << "[" << text << "] ";
+    std::cout << std::endl;
+
+    // The chunks parsed by each thread do not split quoted values
+    {
+      std::ofstream file("test-alloc.csv", std::ios::out | std::ios::binary);
+      for (size_t i = 0; i < 20000; ++i)
+        file << i << ",\"line\nbreak, \"\"" << i << "\"\"\n\",x\n";
+    }
+    CSVFileReader<int, std::string, std::string> one("test-alloc.csv");
+    CSVFileReader<int, std::string, std::string> four("test-alloc.csv", ',', CSVInput::MAPPED, 4);
+    std::cout << four.size() << " " << std::boolalpha << std::equal(one.begin(), one.end(), four.begin(), four.end()) << std::noboolalpha << std::endl;
+    std::remove("test-alloc.csv");
+
+    Tokenizer tokenizer;
+    std::vector<std::string> tokens;
+    tokenizer(tokens, "1,\"a,b\",\"c\"\"d\",e\"f", ',');
+    for (auto& token : tokens)
+      std::cout << "[" << token << "] ";
+    std::cout << std::endl;
+  }
+
+  // TEST HEADER ROW
+  {
+    CSVOptions options;
+    options.header = true;
+    CSVFileReader<int, std::string, double> csv("test-header.csv", options);
+    size_t price{ csv.column("price") };
+    std::cout << csv.size() << " records. Columns:";
+    for (auto& name : csv.header().names())
+      std::cout << " [" << name << "]";
+    std::cout << ". Price column " << price << ": " << std::get<2>(csv[1]) << std::endl;
+
+    // The named columns are the expected schema, read in the order of the names
+    options.names = { "price", "id" };
+    CSVFileReader<double, int> named("test-header.csv", options);
+    for (auto& [p, id] : named)
+      std::cout << id << "=" << p << " ";
+    std::cout << "| id column " << named.column("id") << std::endl;
+
+    options.input = CSVInput::STREAM;
+    CSVFileReaderStr str("test-header.csv", options);
+    std::cout << str.size() << "x" << str.cols() << " " << str[1][str.column("price")] << std::endl;
+
+    try {
+      options.names = { "price", "weight" };
+      CSVFileReader<double, int> missing("test-header.csv", options);
+    }
+    catch (std::runtime_error& e) {
+      std::cout << e.what() << std::endl;
+    }
+    try {
+      options.names = { "price" };
+      CSVFileReader<double, int> wrong("test-header.csv", options);
+    }
+    catch (std::invalid_argument& e) {
+      std::cout << e.what() << std::endl;
+    }
+    try {
+      CSVOptions two;
+      two.header = true;
+      CSVFileReader<int, std::string> inconsistent("test-header.csv", two);
+    }
+    catch (std::range_error& e) {
+      std::cout << e.what() << std::endl;
+    }
+    try {
+      csv.column("weight");
+    }
+    catch (std::out_of_range& e) {
+      std::cout << e.what() << std::endl;
+    }
+  }
+
+  // TEST ROW INDEX
+  {
+    CSVIndexedReader<int, std::string, std::string, double> quoted("test-quoted.csv");
+    for (size_t row : { 3, 0, 1 }) {
+      auto [i, name, text, d] = quoted[row];
+      std::cout << i << " [" << name << "] [" << text << "] " << d << " | ";
+    }
+    std::cout << quoted.size() << " records" << std::endl;
+
+    {
+      std::ofstream file("test-index.csv", std::ios::out | std::ios::binary);
+      file << "# Generated\n";
+      for (size_t i = 0; i < 10000; ++i)
+        file << i << ",\"v, " << i << "\"," << i * 0.5 << "\n";
+    }
+    CSVFileReader<size_t, std::string, double> all("test-index.csv");
+
+    // The records are only indexed as far as they are accessed
+    CSVIndexedReader<size_t, std::string, double> lazy("test-index.csv", ',', 7);
+    std::cout << (lazy[50] == all[50]) << " " << lazy.index().rows() << " rows indexed, " << lazy.index().samples() << " offsets" << std::endl;
+
+    bool same{ true };
+    for (size_t row = 0; row < all.size(); row += 3)
+      same = same && lazy[row] == all[row];
+    std::cout << same << " " << lazy.size() << " " << lazy.index().samples() << " offsets" << std::endl;
+    std::cout << lazy.saveIndex("test-index.idx") << " " << lazy.saveIndex("missing-directory/test-index.idx") << " ";
+    size_t temporary{ 0 };
+    for (const auto& entry : std::filesystem::directory_iterator("."))
+      temporary += entry.path().extension() == ".tmp";
+    std::cout << temporary << std::endl;
+
+    // A saved index is complete as soon as it is loaded
+    CSVIndexedReader<size_t, std::string, double> saved("test-index.csv", ',', 1, "test-index.idx");
+    std::cout << saved.index().complete() << " " << saved.index().step() << " " << (saved[9999] == all[9999]) << " " << saved.line(4) << std::endl;
+    try {
+      saved[10000];
+    }
+    catch (std::out_of_range& e) {
+      std::cout << e.what() << std::endl;
+    }
+
+    // The index of a modified file is discarded
+    {
+      std::ofstream file("test-index.csv", std::ios::out | std::ios::app | std::ios::binary);
+      file << "10000,x,1\n";
+    }
+    CSVIndexedReader<size_t, std::string, double> stale("test-index.csv", ',', 1, "test-index.idx");
+    std::cout << stale.index().complete() << " " << stale.size() << std::endl;
+
+    // An index which cannot be read is ignored
+    std::filesystem::permissions("test-index.idx", std::filesystem::perms::none);
+    CSVIndexedReader<size_t, std::string, double> locked("test-index.csv", ',', 1, "test-index.idx");
+    std::cout << locked.index().complete() << " " << locked.size() << std::endl;
+    std::remove("test-index.csv");
+    std::remove("test-index.idx");
+  }
+
+  // TEST FOLLOW MODE
+  {
+    auto append = [](const std::string& text) {
+      std::ofstream file("test-follow.csv", std::ios::out | std::ios::app | std::ios::binary);
+      file << text;
+    };
+    auto print = [](const CSVFollower<int, std::string>& csv) {
+      for (auto& [i, text] : csv)
+        std::cout << i << "=" << text << " ";
+      std::cout << "| " << csv.offset() << std::endl;
+    };
+    std::remove("test-follow.csv");
+    append("# Log\n1,a\n2,b\n3,");
+
+    // The incomplete line is kept until the rest of it is written
+    CSVFollower<int, std::string> csv("test-follow.csv", ',', false, std::chrono::milliseconds(10));
+    print(csv);
+    append("c\n4,\"d\n");
+    std::cout << csv.poll() << " ";
+    append("dd\"\n");
+    std::cout << csv.poll() << " " << csv.poll() << std::endl;
+    print(csv);
+
+    // Following from the end skips the current content, including the line being written
+    append("5,");
+    CSVFollower<int, std::string> tail("test-follow.csv", ',', true);
+    append("e\n6,f\n");
+    std::cout << tail.poll() << " " << std::get<1>(tail[0]) << std::endl;
+
+    // An invalid record is skipped by the next poll
+    append("x,g\n7,h\n");
+    try {
+      csv.poll();
+    }
+    catch (std::runtime_error& e) {
+      std::cout << e.what() << std::endl;
+    }
+    std::cout << csv.poll() << " " << std::get<1>(csv[csv.size() - 1]) << std::endl;
+
+    // Truncation and rotation read the new content from the start
+    csv.clear();
+    std::ofstream("test-follow.csv", std::ios::out | std::ios::trunc | std::ios::binary) << "8,i\n";
+    std::cout << csv.poll() << " ";
+    print(csv);
+    std::filesystem::rename("test-follow.csv", "test-follow.csv.1");
+    std::ofstream("test-follow.csv", std::ios::out | std::ios::binary) << "9,j\n10,k\n11,l\n";
+    std::cout << csv.poll() << " ";
+    print(csv);
+
+    // wait() returns as soon as a record is appended
+    std::thread writer([&append]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      append("12,m\n");
+    });
+    size_t added{ csv.wait(std::chrono::milliseconds(5000)) };
+    writer.join();
+    std::cout << added << " " << std::get<1>(csv[csv.size() - 1]) << " " << csv.wait(std::chrono::milliseconds(20)) << std::endl;
+    std::remove("test-follow.csv");
+    std::remove("test-follow.csv.1");
+  }
+
+  // TEST MULTIPLE FILES
+  {
+    std::filesystem::create_directory("test-multi");
+    std::vector<std::string> fileNames;
+    size_t total{ 0 };
+    for (size_t f = 0; f < 6; ++f) {
+      fileNames.push_back("test-multi/part-" + std::to_string(f) + ".csv");
+      std::ofstream file(fileNames.back(), std::ios::out | std::ios::binary);
+      // The first file is split in several chunks
+      size_t lines{ f == 0 ? 300000 : f * 100 };
+      file << "id;name;value\n";
+      for (size_t i = 0; i < lines; ++i)
+        file << f * 1000000 + i << ";name " << i << ";" << i * 0.5 << "\n";
+      total += lines;
+    }
+    std::ofstream("test-multi/notes.txt") << "not a csv\n";
+
+    CSVOptions options(';', CSVInput::MAPPED, 4);
+    options.header = true;
+    auto readers{ loadFiles<size_t, std::string, double>(fileNames, options) };
+    bool same{ true };
+    for (size_t f = 0; f < fileNames.size(); ++f) {
+      CSVFileReader<size_t, std::string, double> single(fileNames[f], options);
+      same = same && std::equal(single.begin(), single.end(), readers[f].begin(), readers[f].end());
+    }
+    std::cout << readers.size() << " files " << std::boolalpha << same << " " << readers[0].size() << " " << readers[0].column("value") << std::endl;
+
+    auto globbed{ loadGlob<std::string>("test-multi/part-?.csv", options) };
+    std::cout << globbed.size() << " files, " << globbed[3].size() << "x" << globbed[3].cols() << " " << globbed[3][99][1] << std::endl;
+
+    // Each file resolves its own named columns
+    std::ofstream("test-multi/part-6.csv") << "value;id;name\n0.25;7;x\n";
+    fileNames.push_back("test-multi/part-6.csv");
+    options.names = { "id", "value" };
+    auto merged{ loadMerged<size_t, double>(fileNames, options) };
+    auto [id, value] = merged[merged.size() - 1];
+    std::cout << (merged.size() == total + 1) << " " << std::get<0>(merged[300000]) << " " << id << "=" << value << " " << merged.header()[1] << std::endl;
+
+    // The first error, in the order of the files, refers to its line
+    std::ofstream("test-multi/part-7.csv") << "id;name;value\n1;a;1\n2;b\n";
+    std::ofstream("test-multi/part-8.csv") << "id;name;value\nx;a;1\n";
+    fileNames.pop_back();
+    fileNames.push_back("test-multi/part-7.csv");
+    fileNames.push_back("test-multi/part-8.csv");
+    options.names.clear();
+    try {
+      loadFiles<size_t, std::string, double>(fileNames, options);
+    }
+    catch (std::exception& e) {
+      std::cout << e.what() << std::endl;
+    }
+
+    // With arena strings too, the error is thrown
+    std::ofstream("test-multi/part-9.csv") << "id;name\n1;" << std::string(100, 'n') << "\n2;b;extra\n";
+    try {
+      loadFiles<int, std::pmr::string>({ "test-multi/part-9.csv" }, options);
+    }
+    catch (std::exception& e) {
+      std::cout << e.what() << std::endl;
+    }
+    std::cout << std::noboolalpha;
+    std::filesystem::remove_all("test-multi");
+  }
+
+  // TEST READ AHEAD
+  {
+    {
+      // Records spanning several blocks, with quoted line breaks and a line longer than a block
+      std::ofstream file("test-async.csv", std::ios::out | std::ios::binary);
+      file << "id,text,value\n";
+      for (size_t i = 0; i < 5000; ++i) {
+        file << i << ",";
+        if (i % 7 == 0) file << "\"multi\nline, \"\"" << i << "\"\"\"";
+        else if (i == 2500) file << std::string(10000, 'x');
+        else file << "plain " << i;
+        file << "," << i * 0.5 << "\n";
+      }
+    }
+    CSVOptions options;
+    options.header = true;
+    CSVFileReader<size_t, std::string, double> mapped("test-async.csv", options);
+    options.input = CSVInput::ASYNC;
+    options.bufferSize = 4096;
+    options.queueDepth = 2;
+    CSVFileReader<size_t, std::string, double> async("test-async.csv", options);
+    options.queueDepth = 4;
+    CSVFileReaderStr str("test-async.csv", options);
+    std::cout << async.size() << " " << std::boolalpha << std::equal(mapped.begin(), mapped.end(), async.begin(), async.end()) << " "
+              << str.size() << "x" << str.cols() << " " << (str[7][1] == std::get<1>(mapped[7])) << std::endl;
+
+    CSVColumnReader<int, std::string, std::string, double> columns("test-quoted.csv", ',', CSVInput::ASYNC);
+    for (auto& text : columns.column<2>())
+      std::cout << "[" << text << "] ";
+    std::cout << std::endl;
+
+    // The blocks are returned in order, and the last one is empty
+    ReadAhead reader("test-async.csv", 1000, 3);
+    size_t bytes{ 0 };
+    size_t blocks{ 0 };
+    for (std::string_view block = reader.next(); !block.empty(); block = reader.next()) {
+      bytes += block.size();
+      ++blocks;
+    }
+    std::cout << (bytes == std::filesystem::file_size("test-async.csv")) << " " << blocks << std::noboolalpha << std::endl;
+    std::remove("test-async.csv");
+
+    try {
+      ReadAhead missing("test-missing.csv");
+    }
+    catch (std::runtime_error& e) {
+      std::cout << e.what() << std::endl;
+    }
+  }
+
+  // TEST COMPRESSED FILES
+  {
+    std::string plainName{ "test-header.csv" }, gzipName{ "test-header.csv.gz" }, zstdName{ "test-header.csv.zst" };
+    std::cout << int(detectCompression(plainName)) << int(detectCompression(gzipName)) << int(detectCompression(zstdName)) << std::endl;
+
+    // Without the library of a format, its files cannot be read
+    for (const std::string& fileName : { gzipName, zstdName }) {
+      try {
+        CSVOptions options;
+        options.header = true;
+        for (CSVInput input : { CSVInput::MAPPED, CSVInput::ASYNC, CSVInput::STREAM }) {
+          options.input = input;
+          CSVFileReader<int, std::string, double> csv(fileName, options);
+          std::cout << csv.size() << ":" << std::get<1>(csv[1]) << ":" << std::get<2>(csv[2]) << " ";
+        }
+        CSVStream<std::string, std::string, std::string> stream(fileName);
+        while (stream.next());
+        std::cout << stream.count() << std::endl;
+      }
+      catch (std::runtime_error& e) {
+        std::cout << e.what() << std::endl;
+      }
+    }
+
+#ifdef FILE_READER_WITH_ZLIB
+    {
+      // Two concatenated members, split inside a record, decompressed in blocks smaller than the records
+      std::string plain;
+      for (size_t i = 0; i < 20000; ++i)
+        plain += std::to_string(i) + ",\"v\n" + std::to_string(i) + "\"," + std::to_string(i * 0.25) + "\n";
+      gzFile file{ gzopen("test-big.csv.gz", "wb") };
+      gzwrite(file, plain.data(), unsigned(plain.size() / 2));
+      gzclose(file);
+      file = gzopen("test-big.csv.gz", "ab");
+      gzwrite(file, plain.data() + plain.size() / 2, unsigned(plain.size() - plain.size() / 2));
+      gzclose(file);
+
+      CSVOptions options;
+      options.bufferSize = 4096;
+      CSVFileReader<size_t, std::string, double> mapped("test-big.csv.gz", options);
+      options.input = CSVInput::ASYNC;
+      CSVFileReader<size_t, std::string, double> async("test-big.csv.gz", options);
+      options.input = CSVInput::STREAM;
+      CSVFileReader<size_t, std::string, double> stream("test-big.csv.gz", options);
+      FileBuffer buffer("test-big.csv.gz");
+      std::cout << mapped.size() << " " << std::boolalpha << (buffer.view() == plain) << " " << (std::get<1>(mapped[19999]) == "v\n19999")
+                << " " << std::equal(mapped.begin(), mapped.end(), async.begin(), async.end())
+                << " " << std::equal(mapped.begin(), mapped.end(), stream.begin(), stream.end()) << std::noboolalpha << std::endl;
+
+      // Truncated in the middle of the second member
+      std::string compressed;
+      {
+        std::ifstream in("test-big.csv.gz", std::ios::in | std::ios::binary);
+        compressed.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+      }
+
+#ifndef _WIN32
+      // Compressed content read from a pipe, which cannot be mapped
+      mkfifo("test-pipe.csv.gz", 0600);
+      for (int pass = 0; pass < 3; ++pass) {
+        std::thread writer([&compressed]() { std::ofstream("test-pipe.csv.gz", std::ios::out | std::ios::binary).write(compressed.data(), std::streamsize(compressed.size())); });
+        if (pass == 0) {
+          FileBuffer piped("test-pipe.csv.gz");
+          std::cout << std::boolalpha << piped.mapped() << " " << (piped.view() == plain) << " ";
+        }
+        else if (pass == 1) {
+          CSVStream<size_t, std::string, double> piped("test-pipe.csv.gz");
+          while (piped.next());
+          std::cout << piped.count() << " ";
+        }
+        else {
+          options.input = CSVInput::STREAM;
+          CSVFileReader<size_t, std::string, double> piped("test-pipe.csv.gz", options);
+          std::cout << std::equal(mapped.begin(), mapped.end(), piped.begin(), piped.end()) << std::noboolalpha << std::endl;
+        }
+        writer.join();
+      }
+      std::remove("test-pipe.csv.gz");
+#endif
+      std::ofstream("test-big.csv.gz", std::ios::out | std::ios::binary).write(compressed.data(), std::streamsize(compressed.size() - 100));
+      try {
+        options.input = CSVInput::ASYNC;
+        CSVFileReader<size_t, std::string, double> truncated("test-big.csv.gz", options);
+      }
+      catch (std::runtime_error& e) {
+        std::cout << e.what() << std::endl;
+      }
+      std::remove("test-big.csv.gz");
+    }
+#endif
+
+#ifndef _WIN32
+    // Plain content read from a pipe, with every kind of input, without and with a header naming the columns
+    mkfifo("test-pipe.csv", 0600);
+    for (bool header : { false, true }) {
+      for (CSVInput input : { CSVInput::MAPPED, CSVInput::ASYNC, CSVInput::STREAM }) {
+        std::thread writer([header]() { std::ofstream("test-pipe.csv", std::ios::out | std::ios::binary) << (header ? "# ids\nname;id\n" : "") << "a;1\nb;2\nc;3\n"; });
+        CSVOptions options(';', input);
+        options.header = header;
+        if (header)
+          options.names = { "id", "name" };
+        else
+          options.selection = CSVSelection{ 1, 0 };
+        CSVFileReader<int, std::string> piped("test-pipe.csv", options);
+        writer.join();
+        std::cout << piped.size() << ":" << std::get<0>(piped[2]) << std::get<1>(piped[2]) << (header ? piped.header()[1] : "") << " ";
+      }
+    }
+    std::cout << std::endl;
+    std::remove("test-pipe.csv");
+#endif
+  }
+
+  // TEST PROPERTIES LOOKUP
+  {
+    {
+      std::ofstream file("test-many.prop", std::ios::out | std::ios::binary);
+      for (size_t i = 0; i < 1000; ++i)
+        file << "key." << i << " = " << i << "\n";
+      for (size_t i = 0; i < 1000; i += 100)
+        file << "key." << i << " = " << i + 1 << "\n";
+    }
+    PropertiesFileReader many("test-many.prop");
+    std::remove("test-many.prop");
+
+    // Looked up by string_view, without building a string
+    bool found{ true };
+    char key[16];
+    for (size_t i = 0; i < 1000; ++i) {
+      int length{ std::snprintf(key, sizeof(key), "key.%zu", i) };
+      found = found && many.value<size_t>(std::string_view(key, size_t(length))) == i;
+    }
+    auto duplicated{ many.values<int>("key.500") };
+    auto keys{ many.keys() };
+    std::cout << std::boolalpha << found << " " << keys.size() << " " << std::is_sorted(keys.begin(), keys.end()) << std::noboolalpha
+              << " " << duplicated.size() << ":" << duplicated[0] << ":" << duplicated[1] << " " << many.values("key.1000").size() << std::endl;
+
+    // Keys resolved once into handles
+    auto handle{ many.handle("key.500") };
+    auto handles{ many.values<int>(handle) };
+    std::cout << many.value<int>(handle) << " " << many[many.handle("key.7")] << " " << handles.size() << ":" << handles[1];
+    try {
+      many.handle("key.1000");
+    }
+    catch (std::out_of_range& e) {
+      std::cout << " " << e.what();
+    }
+    std::cout << std::endl;
+
+    // Keys starting with a prefix, without copying them
+    size_t before{ allocations };
+    size_t count{ 0 };
+    int sum{ 0 };
+    for (auto [key, handle] : many.withPrefix("key.1")) {
+      count += key.substr(0, 5) == "key.1";
+      sum += many.value<int>(handle);
+    }
+    size_t allocated{ allocations - before };
+    auto range{ many.withPrefix("key.99") };
+    std::cout << count << " " << sum << " " << allocated << " " << range.size() << ":" << (*range.begin()).first << " "
+              << many.withPrefix("").size() << " " << many.withPrefix("key.9999").empty() << " " << many.withPrefix("zzz").empty() << std::endl;
+  }
+
+  // TEST PROPERTIES CONVERSIONS
+  {
+    {
+      std::ofstream file("test-types.prop", std::ios::out | std::ios::binary);
+      file << "short = 70000\nnegative = -1\nreal = 0.1\nflag = TRUE\nzero = 0\nbig = 18446744073709551615\n";
+    }
+    PropertiesFileReader types("test-types.prop");
+    std::remove("test-types.prop");
+
+    // The values converted in advance must give the same results as converting the text
+    auto check = [&types](const std::string& key, auto value) {
+      using TYPE = decltype(value);
+      bool expected{ fromString(types[key], value) };
+      try {
+        TYPE converted{ types.value<TYPE>(key) };
+        return expected && converted == value;
+      }
+      catch (std::runtime_error&) {
+        return !expected;
+      }
+    };
+    bool same{ true };
+    for (std::string key : { "short", "negative", "real", "flag", "zero", "big" }) {
+      same = same && check(key, short()) && check(key, int()) && check(key, int64_t()) && check(key, uint8_t()) && check(key, unsigned())
+             && check(key, uint64_t()) && check(key, float()) && check(key, double()) && check(key, (long double)(0)) && check(key, bool());
+    }
+    std::cout << std::boolalpha << same << " " << types.value<bool>("flag") << " " << types.value<float>("real") << " " << types.value<uint64_t>("big");
+    try {
+      types.value<short>("short");
+    }
+    catch (std::runtime_error& e) {
+      std::cout << " " << e.what();
+    }
+
+    // Concurrent readers
+    std::atomic<bool> correct{ true };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+      threads.emplace_back([&types, &correct]() {
+        for (int i = 0; i < 10000; ++i)
+          if (types.value<double>("real") != 0.1 || types.value<int>("negative") != -1)
+            correct = false;
+      });
+    for (auto& thread : threads)
+      thread.join();
+    std::cout << " " << correct << std::noboolalpha << std::endl;
+  }
+
+  // TEST RELOADABLE PROPERTIES
+  {
+    // The file is replaced atomically, as it should be
+    auto write = [](int version) {
+      std::ofstream("test-reload.tmp", std::ios::out | std::ios::binary) << "version = " << version << "\nmirror = " << version << "\n";
+      std::filesystem::rename("test-reload.tmp", "test-reload.prop");
+    };
+    write(1);
+    ReloadableProperties properties("test-reload.prop");
+    std::cout << properties.version() << ":" << properties.value<int>("version");
+
+    // The readers always see both keys from the same version, while it is replaced
+    std::atomic<bool> stop{ false };
+    std::atomic<bool> consistent{ true };
+    std::atomic<size_t> reads{ 0 };
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; ++t)
+      readers.emplace_back([&]() {
+        while (!stop) {
+          auto snapshot{ properties.snapshot() };
+          if (snapshot->value<int>("version") != snapshot->value<int>("mirror"))
+            consistent = false;
+          ++reads;
+        }
+      });
+    for (int version = 2; version <= 20; ++version) {
+      size_t published{ properties.version() };
+      write(version);
+      // Reloaded by the background thread. Without inotify, the modification time may need to change
+      for (int i = 0; i < 300 && properties.version() == published; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (!properties.watching() && i % 50 == 49)
+          write(version);
+      }
+    }
+    stop = true;
+    for (auto& reader : readers)
+      reader.join();
+    std::cout << " " << properties.value<int>("version") << " " << std::boolalpha << consistent << " " << (reads > 0);
+
+    // Publishing does not wait for the readers, so a thread holding a snapshot can reload the file
+    {
+      auto held{ properties.snapshot() };
+      write(21);
+      bool reloaded{ properties.reload() };
+      std::cout << " " << reloaded << " " << held->value<int>("version") << ":" << properties.value<int>("version");
+    }
+
+    // Snapshots taken while another thread publishes are never deleted under their readers
+    {
+      std::atomic<bool> publishing{ true };
+      std::vector<std::thread> takers;
+      for (int t = 0; t < 3; ++t)
+        takers.emplace_back([&]() {
+          while (publishing) {
+            auto snapshot{ properties.snapshot() };
+            if (snapshot->value<int>("version") != snapshot->value<int>("mirror"))
+              consistent = false;
+          }
+        });
+      for (int i = 0; i < 500; ++i)
+        properties.reload();
+      publishing = false;
+      for (auto& taker : takers)
+        taker.join();
+      std::cout << " " << consistent;
+    }
+
+    // A missing file keeps the last snapshot
+    std::remove("test-reload.prop");
+    std::cout << " " << properties.reload() << " " << properties["mirror"] << std::noboolalpha << std::endl;
+  }
+}